@@ -0,0 +1,149 @@
+// Prints one tab-separated line per benchmark and expression:
+//   benchmark  expression  iterations  ns_per_op  allocs_per_op
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static size_t allocations;
+
+static void *counting_malloc(size_t size) {
+  allocations++;
+  return malloc(size);
+}
+
+static void *counting_calloc(size_t count, size_t size) {
+  allocations++;
+  return calloc(count, size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+  allocations++;
+  return realloc(ptr, size);
+}
+
+#define PARSEDICE_MALLOC(size) counting_malloc(size)
+#define PARSEDICE_CALLOC(count, size) counting_calloc(count, size)
+#define PARSEDICE_REALLOC(ptr, size) counting_realloc(ptr, size)
+#define PARSEDICE_FREE(ptr) free(ptr)
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+// Each benchmark runs for at least this long.
+#define BENCH_MIN_SECONDS 0.2
+
+static const char *corpus[] = {
+    "5",
+    "1d20",
+    "2d6 + 3",
+    "(3d6 - 2) * 10",
+    "1d20 + 5 - 1d4 * 2 + 3d8 / 2 - (1d6 + 1d6) * 4 + 10",
+    "((((((((1d4 + 1) * 2) - 1d6) + 3) * (2d8 - 1)) / 2) + 1d12) - 4)",
+    "100d6",
+    "10000d20 + 5",
+    "1000000d6",
+};
+
+// Keeps results alive so the compiler can't drop the work.
+static volatile double sink;
+
+typedef void (*BenchFn)(void *state);
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(const char *name, const char *expression, BenchFn fn,
+                void *state) {
+  // Warm up caches and any one-time allocations.
+  fn(state);
+
+  size_t iterations = 1;
+
+  for (;;) {
+    allocations = 0;
+    double start = now();
+
+    for (size_t i = 0; i < iterations; i++)
+      fn(state);
+
+    double elapsed = now() - start;
+
+    if (elapsed >= BENCH_MIN_SECONDS) {
+      printf("%s\t%s\t%zu\t%.1f\t%.2f\n", name, expression, iterations,
+             elapsed * 1e9 / iterations, (double)allocations / iterations);
+      return;
+    }
+
+    iterations *= elapsed > 0 && BENCH_MIN_SECONDS / elapsed < 100
+                      ? (size_t)(BENCH_MIN_SECONDS / elapsed) + 1
+                      : 100;
+  }
+}
+
+static void bench_parse(void *state) {
+  ParseDiceExpression e = parsedice_parse_string(state);
+
+  sink = e.length;
+  parsedice_expression_destroy(&e);
+}
+
+static void bench_to_postfix(void *state) {
+  ParseDiceExpression postfix =
+      parsedice_expression_to_postfix(*(ParseDiceExpression *)state);
+
+  sink = postfix.length;
+  parsedice_expression_destroy(&postfix);
+}
+
+static void bench_evaluate(void *state) {
+  ParserItem result =
+      parsedice_expression_evaluate(*(ParseDiceExpression *)state);
+
+  sink = result.number;
+}
+
+static void bench_program_evaluate(void *state) {
+  sink = parsedice_program_evaluate(state, parsedice_rng_default());
+}
+
+static void bench_dice_roll(void *state) {
+  sink = parsedice_dice_roll(*(Dice *)state, NULL);
+}
+
+int main(void) {
+  printf("benchmark\texpression\titerations\tns_per_op\tallocs_per_op\n");
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(corpus); i++) {
+    ParseDiceExpression e = parsedice_parse_string(corpus[i]);
+    ParseDiceProgram p;
+
+    if (parsedice_program_compile(e, &p) != ParseDiceOk) {
+      fprintf(stderr, "failed to compile %s\n", corpus[i]);
+      return 1;
+    }
+
+    run("parse", corpus[i], bench_parse, (void *)corpus[i]);
+    run("to_postfix", corpus[i], bench_to_postfix, &e);
+    run("evaluate", corpus[i], bench_evaluate, &e);
+    run("program_evaluate", corpus[i], bench_program_evaluate, &p);
+
+    parsedice_program_destroy(&p);
+    parsedice_expression_destroy(&e);
+  }
+
+  Dice pools[] = {
+      {.amount = 1, .faces = 20},      {.amount = 4, .faces = 6},
+      {.amount = 100, .faces = 6},     {.amount = 10000, .faces = 20},
+      {.amount = 1000000, .faces = 6},
+  };
+  char label[64];
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(pools); i++) {
+    snprintf(label, sizeof(label), "%ud%u", pools[i].amount, pools[i].faces);
+    run("dice_roll", label, bench_dice_roll, &pools[i]);
+  }
+}
@@ -1,11 +1,116 @@
 #ifndef PARSEDICE_H
 #define PARSEDICE_H
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define PARSEDICE_DEFAULT_STACK_SIZE 4
 #define PARSEDICE_EXPRESSION_DEFAULT_CAPACITY 2
+#define PARSEDICE_ARENA_DEFAULT_CAPACITY 4096
+
+// Parenthesis and prefix operators nested deeper than this are rejected by
+// the postfix parser, which bounds its recursion.
+#ifndef PARSEDICE_MAX_NESTING
+#define PARSEDICE_MAX_NESTING 256
+#endif
+
+// Programs deeper than this are rejected by parsedice_program_compile, which
+// lets parsedice_program_evaluate keep its value stack on the C stack.
+#ifndef PARSEDICE_PROGRAM_MAX_STACK_DEPTH
+#define PARSEDICE_PROGRAM_MAX_STACK_DEPTH 64
+#endif
+
+// Number of trials parsedice_program_evaluate_batch runs through each
+// instruction at a time.
+#ifndef PARSEDICE_BATCH_BLOCK_SIZE
+#define PARSEDICE_BATCH_BLOCK_SIZE 64
+#endif
+
+// Number of 32-bit random words parsedice_dice_roll_rng draws at once.
+#ifndef PARSEDICE_ROLL_BUFFER_WORDS
+#define PARSEDICE_ROLL_BUFFER_WORDS 256
+#endif
+
+// Largest number of distinct outcomes a distribution may have while it is
+// being computed. Bigger expressions fail with ParseDiceErrorTooLarge.
+#ifndef PARSEDICE_DISTRIBUTION_MAX_SUPPORT
+#define PARSEDICE_DISTRIBUTION_MAX_SUPPORT (1 << 22)
+#endif
+
+// Convolutions where both sides have at least this many entries go through
+// an FFT instead of the quadratic direct sum.
+#ifndef PARSEDICE_DISTRIBUTION_FFT_THRESHOLD
+#define PARSEDICE_DISTRIBUTION_FFT_THRESHOLD 64
+#endif
+
+// Number of alias tables a ParseDiceAliasCache keeps before evicting the
+// least recently used one.
+#ifndef PARSEDICE_ALIAS_CACHE_SIZE
+#define PARSEDICE_ALIAS_CACHE_SIZE 16
+#endif
+
+// Pools with fewer dice are rolled directly, building a table wouldn't pay.
+#ifndef PARSEDICE_ALIAS_MIN_AMOUNT
+#define PARSEDICE_ALIAS_MIN_AMOUNT 8
+#endif
+
+// Pools with more possible sums than this are sampled from a normal
+// approximation instead of an alias table, if they have at least
+// PARSEDICE_NORMAL_MIN_AMOUNT dice. Smaller ones are rolled directly.
+#ifndef PARSEDICE_ALIAS_MAX_SUPPORT
+#define PARSEDICE_ALIAS_MAX_SUPPORT (1 << 16)
+#endif
+
+#ifndef PARSEDICE_NORMAL_MIN_AMOUNT
+#define PARSEDICE_NORMAL_MIN_AMOUNT 1000
+#endif
+
+// Rolling keep/drop dice buckets the faces this many ways. Dice with at
+// most this many faces are selected in one counting pass.
+#ifndef PARSEDICE_SELECT_BUCKETS
+#define PARSEDICE_SELECT_BUCKETS 256
+#endif
+
+// Most times one exploding die is rolled again, so rolling an exploding
+// pool costs a bounded number of draws however the dice land.
+#ifndef PARSEDICE_EXPLODE_CAP
+#define PARSEDICE_EXPLODE_CAP 100
+#endif
+
+// Cap on the steps spent computing the distribution of one keep/drop dice
+// term, beyond which it fails with ParseDiceErrorTooLarge.
+#ifndef PARSEDICE_DISTRIBUTION_MAX_WORK
+#define PARSEDICE_DISTRIBUTION_MAX_WORK (1 << 30)
+#endif
+
+// Trials in each unit of work parsedice_program_simulate hands to a
+// worker. Each chunk has its own generator stream, so results depend on
+// this but not on the number of threads.
+#ifndef PARSEDICE_SIMULATION_CHUNK_SIZE
+#define PARSEDICE_SIMULATION_CHUNK_SIZE (1 << 16)
+#endif
+
+// Buckets in the fixed-range histogram of ParseDiceStats.
+#ifndef PARSEDICE_STATS_HISTOGRAM_BUCKETS
+#define PARSEDICE_STATS_HISTOGRAM_BUCKETS 64
+#endif
+
+// Relative accuracy of ParseDiceStats quantiles, and the number of sketch
+// bins on each side of zero. The defaults keep 1% accuracy for magnitudes
+// between about 1e-9 and 1e9; anything outside lands in the end bins.
+#ifndef PARSEDICE_STATS_SKETCH_ALPHA
+#define PARSEDICE_STATS_SKETCH_ALPHA 0.01
+#endif
+#ifndef PARSEDICE_STATS_SKETCH_BINS
+#define PARSEDICE_STATS_SKETCH_BINS 2048
+#endif
 
 #define PARSEDICE_ARRAY_SIZE(x) ((sizeof x) / (sizeof *x))
 
@@ -16,15 +121,49 @@ typedef struct {
 
 typedef unsigned int DiceInt;
 
+// Which of the rolled dice count towards the sum.
+typedef enum {
+  DiceKeepAll,
+  DiceKeepHighest,
+  DiceKeepLowest,
+} DiceKeep;
+
+// Which dice a success-counting term counts.
+typedef enum {
+  DiceCountNone,
+  DiceCountAtLeast,
+  DiceCountAtMost,
+} DiceCount;
+
 typedef struct {
   DiceInt amount;
   DiceInt faces;
+
+  // Dice kept unless keep is DiceKeepAll, always fewer than amount. Drops
+  // are parsed into the matching keep, so 10d10dl2 is stored as 10d10kh8.
+  DiceKeep keep;
+  DiceInt keep_count;
+
+  // Dice showing their top face are rolled again and added, at most
+  // PARSEDICE_EXPLODE_CAP times per die.
+  bool explode;
+
+  // Faces up to this are rerolled until they don't come up, so 4d6r1
+  // never shows a one. Less than faces; the parser rejects anything else
+  // and dice built with more roll nothing.
+  DiceInt reroll;
+
+  // Unless count is DiceCountNone, the term is the number of dice showing
+  // at least or at most target instead of their sum. Strict comparisons
+  // are parsed into these, so 5d10>7 is stored as 5d10>=8.
+  DiceCount count;
+  DiceInt target;
 } Dice;
 
 // When adding a new operation, don't forget to:
-// - create mapping on op_mappings
-// - add an entry on the precedence_table
-// - add a handler to the op_handlers
+// - create mapping on op_mappings and char_operation
+// - add an entry on the precedence_table and infix_binding_power
+// - add a handler to the op_handlers and op_block_handlers
 typedef enum {
   ParserOperationAdd,
   ParserOperationSub,
@@ -42,13 +181,38 @@ typedef enum {
   ParserNullType,
 } ParserTypes;
 
+// Numbers are floats unless one of these is defined before including:
+//   PARSEDICE_NUMBER_INT64   exact 64-bit integers. Division floors and
+//                            x / 0 is 0, overflow wraps, and fractional
+//                            literals are rejected.
+//   PARSEDICE_NUMBER_DOUBLE  doubles, exact for sums up to 2^53.
+// Print numbers with "%" PARSEDICE_NUMBER_FMT, which like the printers
+// here shows whole numbers.
+#if defined(PARSEDICE_NUMBER_INT64)
+typedef int64_t ParserConstNum;
+#define PARSEDICE_NUMBER_FMT PRId64
+#elif defined(PARSEDICE_NUMBER_DOUBLE)
+typedef double ParserConstNum;
+#define PARSEDICE_NUMBER_FMT ".0f"
+#else
 typedef float ParserConstNum;
+#define PARSEDICE_NUMBER_FMT ".0f"
+#endif
 
 // Please remember to add a string to error_str array
 typedef enum {
   ParserErrorDidNotMatchPattern,
   ParserErrorNoMatches,
   ParserErrorExpectedInt,
+  ParserErrorNumberTooLarge,
+  ParserErrorExpectedOperand,
+  ParserErrorExpectedOperator,
+  ParserErrorUnbalancedParenthesis,
+  ParserErrorTooDeep,
+  ParserErrorExpectedModifier,
+  ParserErrorRerollAll,
+  ParserErrorCountModifier,
+  ParserErrorOutOfMemory,
 } ParserErrorEnum;
 
 typedef struct {
@@ -68,55 +232,627 @@ typedef struct {
   };
 } ParserItem;
 
+typedef struct ParseDiceArenaBlock ParseDiceArenaBlock;
+
+// Bump allocator. Everything allocated from it is released at once by
+// resetting it. Blocks are chained when it runs out of room and merged
+// into one block of the combined size on reset, so a workload that repeats
+// itself stops allocating after the first round.
+typedef struct {
+  ParseDiceArenaBlock *block;
+} ParseDiceArena;
+
 typedef struct {
   ParserItem *items;
   size_t length;
   size_t capacity;
+
+  // Arena items are allocated from, or NULL for the heap.
+  ParseDiceArena *arena;
 } ParseDiceExpression;
 
+typedef struct ParserItemStack ParserItemStack;
+
+// Please remember to add a string to status_str array
+typedef enum {
+  ParseDiceOk,
+  ParseDiceErrorParse,
+  ParseDiceErrorUnbalanced,
+  ParseDiceErrorMissingOperand,
+  ParseDiceErrorMissingOperator,
+  ParseDiceErrorEmpty,
+  ParseDiceErrorTooDeep,
+  ParseDiceErrorOutOfMemory,
+  ParseDiceErrorTooLarge,
+  ParseDiceErrorMismatch,
+  ParseDiceErrorIo,
+  ParseDiceErrorUnsupported,
+} ParseDiceStatus;
+
+typedef enum {
+  ParseDiceOpPushConst,
+  ParseDiceOpRollDice,
+  ParseDiceOpOperation,
+} ParseDiceOpcode;
+
+typedef struct {
+  ParseDiceOpcode opcode;
+
+  union {
+    // Index into ParseDiceProgram.constants or ParseDiceProgram.dice
+    size_t index;
+    ParserOperation operation;
+  };
+} ParseDiceInstruction;
+
+// A validated postfix program. All arrays live in a single allocation owned
+// by the program and are never written after parsedice_program_compile
+// returns, so one program can be evaluated from many threads at once.
+typedef struct {
+  const ParseDiceInstruction *code;
+  size_t length;
+
+  const ParserConstNum *constants;
+  size_t constants_length;
+
+  const Dice *dice;
+  size_t dice_length;
+
+  size_t max_stack_depth;
+  // Most dice one evaluation can roll, which is what a ParseDiceRollLog
+  // needs room for. SIZE_MAX if that doesn't fit a size_t.
+  size_t max_rolls;
+} ParseDiceProgram;
+
+// xoshiro256** state. Every roll and evaluate function takes one of these
+// explicitly, so each thread can own its generator and any roll can be
+// reproduced from its seed.
+typedef struct {
+  uint64_t s[4];
+} ParseDiceRng;
+
+void parsedice_rng_seed(ParseDiceRng *rng, uint64_t seed);
+uint64_t parsedice_rng_next(ParseDiceRng *rng);
+uint32_t parsedice_rng_bounded(ParseDiceRng *rng, uint32_t bound);
+void parsedice_rng_jump(ParseDiceRng *rng);
+void parsedice_rng_long_jump(ParseDiceRng *rng);
+ParseDiceRng parsedice_rng_split(ParseDiceRng *rng);
+ParseDiceRng *parsedice_rng_default(void);
+
 ParserConstNum parsedice_dice_roll(Dice d, ParserConstNum results[]);
+ParserConstNum parsedice_dice_roll_rng(ParseDiceRng *rng, Dice d,
+                                       ParserConstNum results[]);
+ParseDiceStatus parsedice_dice_roll_counts(ParseDiceRng *rng, Dice d,
+                                           uint64_t counts[],
+                                           size_t counts_length);
 
 ParseDiceExpression parsedice_parse_string(const char *string);
+ParseDiceExpression parsedice_parse_slice(StringSlice slice);
+ParseDiceExpression parsedice_parse_string_postfix(const char *string);
+ParseDiceExpression parsedice_parse_slice_postfix(StringSlice slice);
 const char *parsedice_parse_error_to_string(ParserError error);
 
-const char parsedice_operation_to_char(ParserOperation type);
+char parsedice_operation_to_char(ParserOperation type);
 
 void parsedice_parser_item_print(ParserItem i);
+void parsedice_parser_item_fprint(FILE *stream, ParserItem i);
+int parsedice_parser_item_snprint(char *buffer, size_t size, ParserItem i);
 
 ParseDiceExpression parsedice_expression_create(void);
 void parsedice_expression_destroy(ParseDiceExpression *e);
 void parsedice_expression_append(ParseDiceExpression *e, ParserItem i);
 bool parsedice_expression_is_balanced(ParseDiceExpression ex);
 ParserItem parsedice_expression_evaluate(ParseDiceExpression e);
+ParserItem parsedice_expression_evaluate_rng(ParseDiceRng *rng,
+                                             ParseDiceExpression e);
 ParseDiceExpression parsedice_expression_to_postfix(ParseDiceExpression e);
 ParserItem parsedice_expression_evaluate_postfix(ParseDiceExpression e);
+ParserItem parsedice_expression_evaluate_postfix_rng(ParseDiceRng *rng,
+                                                     ParseDiceExpression e);
 void parsedice_expression_print_errors(const char *original_string,
                                        ParseDiceExpression e);
+void parsedice_expression_fprint_errors(FILE *stream,
+                                        const char *original_string,
+                                        ParseDiceExpression e);
 void parsedice_expression_print(ParseDiceExpression e);
+void parsedice_expression_fprint(FILE *stream, ParseDiceExpression e);
+int parsedice_expression_snprint(char *buffer, size_t size,
+                                 ParseDiceExpression e);
+
+const char *parsedice_status_to_string(ParseDiceStatus status);
+
+ParseDiceStatus parsedice_program_compile(ParseDiceExpression e,
+                                          ParseDiceProgram *out);
+ParseDiceStatus parsedice_program_compile_postfix(ParseDiceExpression postfix,
+                                                  ParseDiceProgram *out);
+ParseDiceStatus parsedice_program_compile_string(const char *string,
+                                                 ParseDiceProgram *out);
+ParseDiceStatus parsedice_program_compile_slice(StringSlice source,
+                                                ParseDiceProgram *out,
+                                                ParserError *error);
+void parsedice_program_destroy(ParseDiceProgram *p);
+ParserConstNum parsedice_program_evaluate(const ParseDiceProgram *p,
+                                          ParseDiceRng *rng);
+
+// The dice one dice term rolled, at rolls[offset .. offset + length) of
+// its ParseDiceRollLog.
+typedef struct {
+  Dice dice;
+  size_t offset;
+  size_t length;
+  ParserConstNum sum;
+} ParseDiceRollSpan;
+
+// Caller-owned buffers that an evaluation writes every die into, with one
+// span per dice term in evaluation order. rolls needs room for the
+// program's max_rolls and spans for its dice_length.
+typedef struct {
+  ParserConstNum *rolls;
+  size_t rolls_capacity;
+  size_t rolls_length;
+
+  ParseDiceRollSpan *spans;
+  size_t spans_capacity;
+  size_t spans_length;
+} ParseDiceRollLog;
+
+// Evaluates p like parsedice_program_evaluate and logs every die, without
+// allocating. Fails with ParseDiceErrorTooLarge, before rolling anything,
+// when the log is too small.
+ParseDiceStatus parsedice_program_evaluate_logged(const ParseDiceProgram *p,
+                                                  ParseDiceRng *rng,
+                                                  ParseDiceRollLog *log,
+                                                  ParserConstNum *result);
+
+void parsedice_program_evaluate_batch(const ParseDiceProgram *p,
+                                      ParseDiceRng *rng,
+                                      ParserConstNum results[], size_t n);
+ParseDiceStatus parsedice_expression_evaluate_batch(ParseDiceRng *rng,
+                                                    ParseDiceExpression e,
+                                                    ParserConstNum results[],
+                                                    size_t n);
+
+// Exact probability mass function. values is sorted in ascending order and
+// only outcomes with a non-zero probability are listed.
+typedef struct {
+  ParserConstNum *values;
+  double *probabilities;
+  size_t length;
+} ParseDiceDistribution;
+
+ParseDiceStatus parsedice_dice_distribution(Dice d, ParseDiceDistribution *out);
+ParseDiceStatus parsedice_program_distribution(const ParseDiceProgram *p,
+                                               ParseDiceDistribution *out);
+void parsedice_distribution_destroy(ParseDiceDistribution *d);
+
+// Walker/Vose alias table for the sum of one dice pool.
+typedef struct {
+  Dice dice;
+
+  // One allocation, owned by probabilities.
+  double *probabilities;
+  ParserConstNum *values;
+  uint32_t *alias;
+  size_t length;
+
+  uint64_t last_used;
+} ParseDiceAliasTable;
+
+// Bounded cache of alias tables. It is not synchronized, give each thread
+// its own.
+typedef struct {
+  ParseDiceAliasTable tables[PARSEDICE_ALIAS_CACHE_SIZE];
+  size_t length;
+  uint64_t clock;
+} ParseDiceAliasCache;
+
+void parsedice_alias_cache_init(ParseDiceAliasCache *c);
+void parsedice_alias_cache_destroy(ParseDiceAliasCache *c);
+ParserConstNum parsedice_dice_sample(ParseDiceAliasCache *c, ParseDiceRng *rng,
+                                     Dice d);
+
+// Owns everything one thread needs to parse and evaluate: an arena for
+// expressions, a scratch stack, a generator and an alias cache. After the
+// first few expressions nothing in parse -> postfix -> evaluate calls the
+// allocator. Expressions returned by a context stay valid until
+// parsedice_context_reset.
+typedef struct {
+  ParseDiceArena arena;
+  ParserItemStack *scratch;
+  ParseDiceRng rng;
+  ParseDiceAliasCache alias_cache;
+} ParseDiceContext;
+
+void parsedice_context_init(ParseDiceContext *ctx, uint64_t seed);
+void parsedice_context_destroy(ParseDiceContext *ctx);
+void parsedice_context_reset(ParseDiceContext *ctx);
+ParseDiceExpression parsedice_context_parse(ParseDiceContext *ctx,
+                                            const char *string);
+ParseDiceExpression parsedice_context_parse_slice(ParseDiceContext *ctx,
+                                                  StringSlice slice);
+ParseDiceExpression parsedice_context_parse_slice_postfix(ParseDiceContext *ctx,
+                                                          StringSlice slice);
+ParseDiceExpression parsedice_context_to_postfix(ParseDiceContext *ctx,
+                                                 ParseDiceExpression e);
+ParserItem parsedice_context_evaluate(ParseDiceContext *ctx,
+                                      ParseDiceExpression e);
+
+// What parsedice_program_optimize changed.
+typedef struct {
+  size_t constants_folded;
+  size_t dice_merged;
+  size_t identities_removed;
+  size_t constants_hoisted;
+
+  size_t instructions_before;
+  size_t instructions_after;
+} ParseDiceOptimizeReport;
+
+ParseDiceStatus parsedice_program_optimize(const ParseDiceProgram *p,
+                                           ParseDiceProgram *out,
+                                           ParseDiceOptimizeReport *report);
+
+// Bounded cache from expression text to compiled programs. Lookups from
+// many threads only share a read lock; the programs it hands out stay
+// valid until they are released, even if the cache evicts them meanwhile.
+// Define PARSEDICE_NO_THREADS to leave it out on platforms without
+// pthreads.
+#ifndef PARSEDICE_NO_THREADS
+typedef struct ParseDiceProgramCache ParseDiceProgramCache;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t length;
+} ParseDiceCacheStats;
+
+ParseDiceProgramCache *parsedice_program_cache_create(size_t capacity);
+void parsedice_program_cache_destroy(ParseDiceProgramCache *c);
+const ParseDiceProgram *
+parsedice_program_cache_get(ParseDiceProgramCache *c, StringSlice source,
+                            ParseDiceStatus *status);
+void parsedice_program_cache_release(ParseDiceProgramCache *c,
+                                     const ParseDiceProgram *p);
+ParseDiceCacheStats parsedice_program_cache_stats(ParseDiceProgramCache *c);
+#endif
+
+// Count, mean, spread and range of a stream of results, kept in one pass
+// with Welford's method.
+typedef struct {
+  uint64_t n;
+  double mean;
+  // Sum of squared differences from the mean.
+  double m2;
+  ParserConstNum min;
+  ParserConstNum max;
+} ParseDiceMoments;
+
+// One-pass statistics over any number of results in constant memory:
+// moments, a histogram over [histogram_low, histogram_high) and a
+// DDSketch for quantiles. Accumulators built on different threads can be
+// merged.
+typedef struct {
+  ParseDiceMoments moments;
+
+  double histogram_low;
+  double histogram_high;
+  uint64_t histogram[PARSEDICE_STATS_HISTOGRAM_BUCKETS];
+  uint64_t underflow;
+  uint64_t overflow;
+
+  uint64_t sketch_zero;
+  uint64_t sketch_positive[PARSEDICE_STATS_SKETCH_BINS];
+  uint64_t sketch_negative[PARSEDICE_STATS_SKETCH_BINS];
+} ParseDiceStats;
+
+void parsedice_stats_init(ParseDiceStats *s, double histogram_low,
+                          double histogram_high);
+void parsedice_stats_add(ParseDiceStats *s, ParserConstNum x);
+void parsedice_stats_add_batch(ParseDiceStats *s, const ParserConstNum *xs,
+                               size_t n);
+ParseDiceStatus parsedice_stats_merge(ParseDiceStats *into,
+                                      const ParseDiceStats *from);
+double parsedice_stats_variance(const ParseDiceStats *s);
+double parsedice_stats_quantile(const ParseDiceStats *s, double q);
+
+// Summary of a Monte Carlo run.
+typedef struct {
+  size_t trials;
+  double mean;
+  double variance;
+  ParserConstNum min;
+  ParserConstNum max;
+} ParseDiceSimulation;
+
+// Runs trials evaluations of p split across threads workers (0 picks one
+// per online CPU). Chunk i of the trials draws from the seed's stream
+// after i jumps and chunk summaries are merged in chunk order, so the
+// result for a given seed is bit-identical whatever the thread count.
+ParseDiceStatus parsedice_program_simulate(const ParseDiceProgram *p,
+                                           uint64_t seed, size_t trials,
+                                           unsigned threads,
+                                           ParseDiceSimulation *out);
+// Same, but merges every trial into stats, which must be initialized.
+// Also bit-identical across thread counts.
+ParseDiceStatus parsedice_program_simulate_stats(const ParseDiceProgram *p,
+                                                 uint64_t seed, size_t trials,
+                                                 unsigned threads,
+                                                 ParseDiceStats *stats);
+
+// A line of a bulk-loaded file that didn't compile.
+typedef struct {
+  // 1-based.
+  size_t line;
+  // Byte offset into the line where parsing stopped, for parse errors.
+  size_t column;
+  ParseDiceStatus status;
+  // Set when status is ParseDiceErrorParse.
+  ParserErrorEnum error;
+} ParseDiceLineError;
+
+// Every expression of a newline-delimited source compiled in one block.
+// Programs keep the order of their lines and blank lines are skipped. The
+// table owns its programs: free it with parsedice_program_table_destroy,
+// never the programs one by one.
+typedef struct {
+  ParseDiceProgram *programs;
+  // Source line of each program, 1-based.
+  size_t *lines;
+  size_t length;
+
+  ParseDiceLineError *errors;
+  size_t errors_length;
+} ParseDiceProgramTable;
+
+// Lines are compiled in place from slices of text, split into up to
+// threads chunks (0 picks one per online CPU). The result doesn't depend
+// on the thread count.
+ParseDiceStatus parsedice_program_table_parse(StringSlice text,
+                                              unsigned threads,
+                                              ParseDiceProgramTable *out);
+// Memory-maps the file at path and parses it as above.
+ParseDiceStatus parsedice_program_table_load(const char *path,
+                                             unsigned threads,
+                                             ParseDiceProgramTable *out);
+void parsedice_program_table_destroy(ParseDiceProgramTable *t);
+
+// Hot-path counters, kept per thread. Define PARSEDICE_INSTRUMENTATION
+// next to PARSEDICE_IMPLEMENTATION to collect them; without it none of
+// this exists and the hot paths are unchanged.
+#ifdef PARSEDICE_INSTRUMENTATION
+// Stages nest: evaluating includes the time spent rolling, and compiling
+// an infix expression includes converting it to postfix.
+typedef enum {
+  ParseDiceStageParse,
+  ParseDiceStageToPostfix,
+  ParseDiceStageCompile,
+  ParseDiceStageEvaluate,
+  ParseDiceStageRoll,
+  ParseDiceStageCount,
+} ParseDiceStage;
+
+typedef struct {
+  uint64_t tokens_lexed;
+  // Heap allocations and reallocations of expressions and item stacks.
+  uint64_t allocations;
+  uint64_t reallocations;
+  uint64_t dice_rolled;
+  uint64_t rng_calls;
+  // Time stamp counter ticks on x86, nanoseconds elsewhere.
+  uint64_t cycles[ParseDiceStageCount];
+} ParseDiceCounters;
+
+ParseDiceCounters parsedice_counters_snapshot(void);
+void parsedice_counters_reset(void);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #ifdef PARSEDICE_IMPLEMENTATION
 #include <assert.h>
-#include <errno.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef PARSEDICE_NO_THREADS
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
+
+// Define all four to route every allocation through your own allocator.
+#ifndef PARSEDICE_MALLOC
+#define PARSEDICE_MALLOC(size) malloc(size)
+#define PARSEDICE_CALLOC(count, size) calloc(count, size)
+#define PARSEDICE_REALLOC(ptr, size) realloc(ptr, size)
+#define PARSEDICE_FREE(ptr) free(ptr)
+#endif
+
+// Define PARSEDICE_NO_SIMD to build only the scalar dice kernel.
+#if !defined(PARSEDICE_NO_SIMD) && defined(__GNUC__) &&                        \
+    (defined(__x86_64__) || defined(__i386__))
+#define PARSEDICE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#ifdef PARSEDICE_INSTRUMENTATION
+static _Thread_local ParseDiceCounters counters;
+
+static inline uint64_t cycle_counter(void) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return __builtin_ia32_rdtsc();
+#else
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+ParseDiceCounters parsedice_counters_snapshot(void) { return counters; }
+
+void parsedice_counters_reset(void) { counters = (ParseDiceCounters){0}; }
+
+#define PARSEDICE_COUNT(counter, n) (counters.counter += (n))
+#define PARSEDICE_STAGE_BEGIN(stage)                                           \
+  uint64_t stage##_started = cycle_counter()
+#define PARSEDICE_STAGE_END(stage)                                             \
+  (counters.cycles[ParseDiceStage##stage] += cycle_counter() - stage##_started)
+#else
+#define PARSEDICE_COUNT(counter, n) ((void)0)
+#define PARSEDICE_STAGE_BEGIN(stage) ((void)0)
+#define PARSEDICE_STAGE_END(stage) ((void)0)
+#endif
+
+static inline size_t align_up(size_t n, size_t alignment) {
+  return (n + alignment - 1) & ~(alignment - 1);
+}
+
+struct ParseDiceArenaBlock {
+  ParseDiceArenaBlock *previous;
+  size_t used;
+  size_t capacity;
+  _Alignas(max_align_t) unsigned char data[];
+};
+
+static ParseDiceArenaBlock *arena_block_create(size_t capacity,
+                                               ParseDiceArenaBlock *previous) {
+  ParseDiceArenaBlock *b = PARSEDICE_MALLOC(sizeof(ParseDiceArenaBlock) + capacity);
+
+  if (b == NULL)
+    return NULL;
+
+  b->previous = previous;
+  b->used = 0;
+  b->capacity = capacity;
+
+  return b;
+}
+
+static void *arena_alloc(ParseDiceArena *a, size_t size) {
+  ParseDiceArenaBlock *b = a->block;
+  size_t start = b == NULL ? 0 : align_up(b->used, _Alignof(max_align_t));
+
+  if (b == NULL || start + size > b->capacity) {
+    size_t capacity = b == NULL ? PARSEDICE_ARENA_DEFAULT_CAPACITY
+                                : b->capacity * 2;
+    while (capacity < size)
+      capacity *= 2;
+
+    b = arena_block_create(capacity, a->block);
+
+    if (b == NULL)
+      return NULL;
+
+    a->block = b;
+    start = 0;
+  }
+
+  b->used = start + size;
+
+  return b->data + start;
+}
+
+// Grows the most recent allocation in place when it is at the end of the
+// current block, otherwise moves it.
+static void *arena_realloc(ParseDiceArena *a, void *ptr, size_t old_size,
+                           size_t new_size) {
+  ParseDiceArenaBlock *b = a->block;
+
+  if (ptr != NULL && b != NULL &&
+      (unsigned char *)ptr + old_size == b->data + b->used &&
+      (unsigned char *)ptr - b->data + new_size <= b->capacity) {
+    b->used = (unsigned char *)ptr - b->data + new_size;
+    return ptr;
+  }
+
+  void *moved = arena_alloc(a, new_size);
+
+  if (moved != NULL && ptr != NULL)
+    memcpy(moved, ptr, old_size);
+
+  return moved;
+}
+
+static void arena_reset(ParseDiceArena *a) {
+  ParseDiceArenaBlock *b = a->block;
+
+  if (b == NULL)
+    return;
+
+  if (b->previous == NULL) {
+    b->used = 0;
+    return;
+  }
+
+  size_t capacity = 0;
+
+  while (b != NULL) {
+    ParseDiceArenaBlock *previous = b->previous;
+
+    capacity += b->capacity;
+    PARSEDICE_FREE(b);
+
+    b = previous;
+  }
+
+  a->block = arena_block_create(capacity, NULL);
+}
+
+static void arena_destroy(ParseDiceArena *a) {
+  ParseDiceArenaBlock *b = a->block;
+
+  while (b != NULL) {
+    ParseDiceArenaBlock *previous = b->previous;
+
+    PARSEDICE_FREE(b);
+
+    b = previous;
+  }
+
+  a->block = NULL;
+}
+
+static ParseDiceExpression expression_create_in(ParseDiceArena *arena) {
+  size_t size = sizeof(ParserItem) * PARSEDICE_EXPRESSION_DEFAULT_CAPACITY;
+
+  if (arena == NULL)
+    PARSEDICE_COUNT(allocations, 1);
 
-ParseDiceExpression parsedice_expression_create(void) {
   return (ParseDiceExpression){
       .capacity = PARSEDICE_EXPRESSION_DEFAULT_CAPACITY,
       .length = 0,
-      .items =
-          malloc(sizeof(ParserItem) * PARSEDICE_EXPRESSION_DEFAULT_CAPACITY),
+      .items = arena == NULL ? PARSEDICE_MALLOC(size) : arena_alloc(arena, size),
+      .arena = arena,
   };
 }
 
+ParseDiceExpression parsedice_expression_create(void) {
+  return expression_create_in(NULL);
+}
+
 void parsedice_expression_append(ParseDiceExpression *e, ParserItem i) {
   if (e->length + 1 > e->capacity) {
     size_t create_capacity = e->capacity * 2;
 
-    e->items = realloc(e->items, sizeof(ParserItem) * create_capacity);
+    if (e->arena == NULL) {
+      e->items = PARSEDICE_REALLOC(e->items, sizeof(ParserItem) * create_capacity);
+      PARSEDICE_COUNT(reallocations, 1);
+    } else
+      e->items = arena_realloc(e->arena, e->items,
+                               sizeof(ParserItem) * e->capacity,
+                               sizeof(ParserItem) * create_capacity);
+
     e->capacity = create_capacity;
   }
 
@@ -124,11 +860,15 @@ void parsedice_expression_append(ParseDiceExpression *e, ParserItem i) {
   e->length++;
 }
 
+// Arena expressions are released by resetting their arena.
 void parsedice_expression_destroy(ParseDiceExpression *e) {
-  free(e->items);
+  if (e->arena == NULL)
+    PARSEDICE_FREE(e->items);
+
   e->items = NULL;
   e->capacity = 0;
   e->length = 0;
+  e->arena = NULL;
 }
 
 static inline StringSlice string_slice_from_c_str(const char *string) {
@@ -138,8 +878,8 @@ static inline StringSlice string_slice_from_c_str(const char *string) {
   };
 }
 
-static inline void string_slice_skip_characters(StringSlice *ps, int n) {
-  if (ps->length < (size_t)n) {
+static inline void string_slice_skip_characters(StringSlice *ps, size_t n) {
+  if (ps->length < n) {
     n = ps->length;
   }
 
@@ -147,50 +887,6 @@ static inline void string_slice_skip_characters(StringSlice *ps, int n) {
   ps->length -= n;
 }
 
-static inline void skip_whitespace(StringSlice *p) {
-  while (p->start[0] == ' ' && p->length > 0)
-    string_slice_skip_characters(p, 1);
-}
-
-static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
-
-static inline DiceInt parse_dice_int(StringSlice *p) {
-  // This stops this function from parsing -XdX or +XdX as a dice.
-  // For instance: "+ +3d6", should be parsed as [OperatorAdd, OperatorAdd,
-  // Dice]. Not as [OperatorAdd, Dice].
-  if (!is_digit(p->start[0])) {
-    errno = EINVAL;
-    return 0;
-  }
-
-  char *end_ptr;
-
-  DiceInt res = strtoul(p->start, &end_ptr, 10);
-
-  if ((end_ptr == p->start) && res == 0) {
-    errno = EINVAL;
-
-    return res;
-  }
-
-  errno = 0;
-  *p = string_slice_from_c_str(end_ptr);
-
-  return res;
-}
-
-static inline bool parse_character(StringSlice *ps, char c) {
-  if (ps->length <= 0)
-    return false;
-
-  if (ps->start[0] != c)
-    return false;
-
-  string_slice_skip_characters(ps, 1);
-
-  return true;
-}
-
 static ParserItem create_parser_error(StringSlice *p, ParserErrorEnum error) {
   return (ParserItem){
       .type = ParserErrorType,
@@ -202,456 +898,4425 @@ static ParserItem create_parser_error(StringSlice *p, ParserErrorEnum error) {
   };
 }
 
-static ParserItem parse_dice(StringSlice *p) {
-  // We have to save the current state of the parser in case the first int
-  // succeds but the rest fails.
-  // Example: 1f 1 will be parsed fine, but f will fail.
-  StringSlice tmp = *p;
-
-  DiceInt amount = parse_dice_int(p);
-
-  if (errno != 0 || !(parse_character(p, 'd'))) {
-    *p = tmp;
-
-    return create_parser_error(p, ParserErrorDidNotMatchPattern);
-  }
-
-  DiceInt faces = parse_dice_int(p);
-
-  if (errno != 0)
-    return create_parser_error(p, ParserErrorExpectedInt);
-
-  return (ParserItem){
-      .type = ParserDiceType,
-      .dice =
-          (Dice){
-              .amount = amount,
-              .faces = faces,
-          },
-  };
-}
-
 typedef struct {
   char character;
   ParserOperation type;
 } OperatorMapping;
 
-static OperatorMapping op_mappings[] = {
+static const OperatorMapping op_mappings[] = {
     {'+', ParserOperationAdd},
     {'-', ParserOperationSub},
     {'*', ParserOperationMul},
     {'/', ParserOperationDiv},
 };
 
-static ParserItem parse_operation(StringSlice *p) {
-  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(op_mappings); i++) {
-    if (parse_character(p, op_mappings[i].character))
-      return (ParserItem){
-          .type = ParserOperationType,
-          .operation = op_mappings[i].type,
-      };
-  }
+// The lexer looks at the first byte of every token once, through these
+// tables, and never reads past StringSlice.length.
+typedef enum {
+  CharClassOther,
+  CharClassSpace,
+  CharClassDigit,
+  CharClassDot,
+  CharClassOperator,
+  CharClassOpenParenthesis,
+  CharClassCloseParenthesis,
+} CharClass;
+
+static const unsigned char char_class[256] = {
+    [' '] = CharClassSpace,   ['\t'] = CharClassSpace,
+    ['\r'] = CharClassSpace,  ['\n'] = CharClassSpace,
+    ['0'] = CharClassDigit,   ['1'] = CharClassDigit,
+    ['2'] = CharClassDigit,   ['3'] = CharClassDigit,
+    ['4'] = CharClassDigit,   ['5'] = CharClassDigit,
+    ['6'] = CharClassDigit,   ['7'] = CharClassDigit,
+    ['8'] = CharClassDigit,   ['9'] = CharClassDigit,
+    ['.'] = CharClassDot,     ['+'] = CharClassOperator,
+    ['-'] = CharClassOperator, ['*'] = CharClassOperator,
+    ['/'] = CharClassOperator, ['('] = CharClassOpenParenthesis,
+    [')'] = CharClassCloseParenthesis,
+};
 
-  return create_parser_error(p, ParserErrorDidNotMatchPattern);
-}
+// Only meaningful for characters of class CharClassOperator.
+static const ParserOperation char_operation[256] = {
+    ['+'] = ParserOperationAdd,
+    ['-'] = ParserOperationSub,
+    ['*'] = ParserOperationMul,
+    ['/'] = ParserOperationDiv,
+};
 
-static inline ParserItem parse_const_num(StringSlice *p) {
-  char *end_ptr;
+static inline CharClass peek_class(const StringSlice *p) {
+  if (p->length == 0)
+    return CharClassOther;
 
-  ParserConstNum res = strtof(p->start, &end_ptr);
+  return (CharClass)char_class[(unsigned char)p->start[0]];
+}
 
-  if ((end_ptr == p->start) && res == 0)
-    return create_parser_error(p, ParserErrorDidNotMatchPattern);
+static inline void skip_whitespace(StringSlice *p) {
+  while (p->length > 0 && peek_class(p) == CharClassSpace)
+    string_slice_skip_characters(p, 1);
+}
 
-  *p = string_slice_from_c_str(end_ptr);
+static inline bool is_digit(char c) { return c >= '0' && c <= '9'; }
 
-  return (ParserItem){
-      .type = ParserConstNumType,
-      .number = res,
-  };
-}
+// Digits beyond what a uint64_t holds exactly are counted in *dropped
+// instead of accumulated.
+static size_t lex_digits(StringSlice *p, uint64_t *value, size_t *dropped) {
+  size_t n = 0;
 
-static ParserItem parse_parenthesis(StringSlice *p) {
-  if (parse_character(p, '('))
-    return (ParserItem){.type = ParserOpenParenthesisType};
+  while (n < p->length && is_digit(p->start[n])) {
+    if (*value < UINT64_C(1000000000000000000))
+      *value = *value * 10 + (uint64_t)(p->start[n] - '0');
+    else
+      (*dropped)++;
 
-  if (parse_character(p, ')'))
-    return (ParserItem){.type = ParserCloseParenthesisType};
+    n++;
+  }
+
+  string_slice_skip_characters(p, n);
 
-  return create_parser_error(p, ParserErrorDidNotMatchPattern);
+  return n;
 }
 
-static ParserItem (*parsers[])(StringSlice *p) = {
-    parse_parenthesis, parse_operation, parse_dice, parse_const_num};
-static ParserItem parse_item(StringSlice *p) {
-  for (size_t i = 0; i < sizeof(parsers) / sizeof(parsers[0]); ++i) {
-    skip_whitespace(p);
+static ParserItem lex_dice_int(StringSlice *p, DiceInt *out) {
+  StringSlice start = *p;
 
-    ParserItem item = parsers[i](p);
+  uint64_t value = 0;
+  size_t dropped = 0;
 
-    skip_whitespace(p);
+  if (lex_digits(p, &value, &dropped) == 0)
+    return create_parser_error(p, ParserErrorExpectedInt);
 
-    if (item.type == ParserErrorType &&
-        item.error.type == ParserErrorDidNotMatchPattern)
-      continue;
-    else
-      return item;
-  }
+  if (dropped > 0 || value > (DiceInt)-1)
+    return create_parser_error(&start, ParserErrorNumberTooLarge);
 
-  return create_parser_error(p, ParserErrorNoMatches);
-}
+  *out = (DiceInt)value;
 
-// Very fast random number generator, credits to Eskil Steenberg.
-// (http://www.gamepipeline.org/forge.html) Range is between 0 and 1
-static float randf(uint index) {
-  index = (index << 13) ^ index;
-  return (((index * (index * index * 15731 + 789221) + 1376312589) &
-           0x7fffffff) /
-          1073741824.0f) *
-         0.5f;
+  return (ParserItem){.type = ParserNullType};
 }
 
-static unsigned int generate_seed() {
-  struct timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
-  return (unsigned int)(ts.tv_nsec ^ ts.tv_sec);
-}
+// Success counting at the end of a dice term: ">=8", ">7", "<=2" or "<3".
+static ParserItem lex_dice_count(StringSlice *p, Dice *d) {
+  if (p->length == 0 || (p->start[0] != '>' && p->start[0] != '<'))
+    return (ParserItem){.type = ParserNullType};
 
-ParserConstNum parsedice_dice_roll(Dice d, ParserConstNum results[]) {
-  static bool seeded = false;
+  StringSlice start = *p;
 
-  if (!seeded) {
-    srand(generate_seed());
-    seeded = true;
-  }
+  if (d->explode || d->keep != DiceKeepAll)
+    return create_parser_error(&start, ParserErrorCountModifier);
 
-  ParserConstNum res = 0;
+  bool at_least = p->start[0] == '>';
+  bool strict = p->length < 2 || p->start[1] != '=';
 
-  for (size_t i = 0; i < d.amount; i++) {
-    ParserConstNum r = (uint)(rand() % d.faces + 1);
+  string_slice_skip_characters(p, strict ? 1 : 2);
 
-    assert(r >= 0);
+  DiceInt target;
+  ParserItem error = lex_dice_int(p, &target);
 
-    if (results != NULL)
-      results[i] = r;
-    res += (r);
-  }
+  if (error.type == ParserErrorType)
+    return error;
 
-  return res;
+  d->count = at_least ? DiceCountAtLeast : DiceCountAtMost;
+  d->target = target;
+
+  if (strict && at_least) {
+    // Nothing beats the largest face, which is counting nothing.
+    if (target == (DiceInt)-1)
+      d->count = DiceCountAtMost, d->target = 0;
+    else
+      d->target = target + 1;
+  } else if (strict) {
+    d->target = target > 0 ? target - 1 : 0;
+  }
+
+  return (ParserItem){.type = ParserNullType};
+}
+
+// Modifiers after the faces: "!" to explode and "r1" to reroll, in either
+// order, then keep/drop as "kh3", "kl1", "dh1" or "dl2", then a success
+// count.
+static ParserItem lex_dice_modifiers(StringSlice *p, Dice *d) {
+  bool rerolls = false;
+
+  for (;;) {
+    if (p->length > 0 && p->start[0] == '!' && !d->explode) {
+      string_slice_skip_characters(p, 1);
+      d->explode = true;
+      continue;
+    }
+
+    if (p->length > 0 && p->start[0] == 'r' && !rerolls) {
+      StringSlice start = *p;
+      string_slice_skip_characters(p, 1);
+
+      ParserItem error = lex_dice_int(p, &d->reroll);
+
+      if (error.type == ParserErrorType)
+        return error;
+
+      if (d->reroll > 0 && d->reroll >= d->faces)
+        return create_parser_error(&start, ParserErrorRerollAll);
+
+      rerolls = true;
+      continue;
+    }
+
+    break;
+  }
+
+  if (p->length == 0 || (p->start[0] != 'k' && p->start[0] != 'd'))
+    return lex_dice_count(p, d);
+
+  if (p->length < 2 || (p->start[1] != 'h' && p->start[1] != 'l'))
+    return create_parser_error(p, ParserErrorExpectedModifier);
+
+  bool keep = p->start[0] == 'k';
+  bool highest = p->start[1] == 'h';
+
+  string_slice_skip_characters(p, 2);
+
+  DiceInt count;
+  ParserItem error = lex_dice_int(p, &count);
+
+  if (error.type == ParserErrorType)
+    return error;
+
+  // Dropping the highest is keeping the lowest of the rest.
+  if (!keep) {
+    count = count < d->amount ? d->amount - count : 0;
+    highest = !highest;
+  }
+
+  if (count < d->amount) {
+    d->keep = highest ? DiceKeepHighest : DiceKeepLowest;
+    d->keep_count = count;
+  }
+
+  return lex_dice_count(p, d);
+}
+
+#ifndef PARSEDICE_NUMBER_INT64
+static double power_of_ten(long exponent) {
+  static const double exact[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                 1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                 1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                 1e18, 1e19, 1e20, 1e21, 1e22};
+
+  if (exponent >= 0 && exponent < (long)PARSEDICE_ARRAY_SIZE(exact))
+    return exact[exponent];
+
+  return pow(10, (double)exponent);
+}
+#endif
+
+// Dice ("3d6") or a number ("32.3", ".5"). The amount of a dice term is
+// the integer part of what would otherwise be a number, so both are read
+// by one scan.
+static ParserItem lex_number(StringSlice *p) {
+  StringSlice start = *p;
+
+  uint64_t mantissa = 0;
+  size_t dropped = 0;
+  size_t int_digits = lex_digits(p, &mantissa, &dropped);
+
+  if (int_digits > 0 && p->length > 0 && p->start[0] == 'd') {
+    if (dropped > 0 || mantissa > (DiceInt)-1)
+      return create_parser_error(&start, ParserErrorNumberTooLarge);
+
+    string_slice_skip_characters(p, 1);
+
+    Dice d = {.amount = (DiceInt)mantissa};
+    ParserItem error = lex_dice_int(p, &d.faces);
+
+    if (error.type == ParserErrorType)
+      return error;
+
+    error = lex_dice_modifiers(p, &d);
+
+    if (error.type == ParserErrorType)
+      return error;
+
+    return (ParserItem){.type = ParserDiceType, .dice = d};
+  }
+
+#ifdef PARSEDICE_NUMBER_INT64
+  if (p->length > 0 && p->start[0] == '.')
+    return create_parser_error(p, ParserErrorExpectedInt);
+
+  if (dropped > 0 || mantissa > INT64_MAX)
+    return create_parser_error(&start, ParserErrorNumberTooLarge);
+
+  return (ParserItem){
+      .type = ParserConstNumType,
+      .number = (ParserConstNum)mantissa,
+  };
+#else
+  long exponent = (long)dropped;
+
+  if (p->length > 0 && p->start[0] == '.') {
+    StringSlice dot = *p;
+    string_slice_skip_characters(p, 1);
+
+    size_t frac_dropped = 0;
+    size_t frac_digits = lex_digits(p, &mantissa, &frac_dropped);
+
+    if (int_digits == 0 && frac_digits == 0) {
+      *p = dot;
+      return create_parser_error(p, ParserErrorNoMatches);
+    }
+
+    exponent -= (long)(frac_digits - frac_dropped);
+  }
+
+  double value = exponent < 0 ? mantissa / power_of_ten(-exponent)
+                              : mantissa * power_of_ten(exponent);
+
+  return (ParserItem){
+      .type = ParserConstNumType,
+      .number = (ParserConstNum)value,
+  };
+#endif
+}
+
+// Returns a ParserNullType item at the end of the input.
+static ParserItem lex_item(StringSlice *p) {
+  skip_whitespace(p);
+
+  if (p->length == 0)
+    return (ParserItem){.type = ParserNullType};
+
+  PARSEDICE_COUNT(tokens_lexed, 1);
+
+  char c = p->start[0];
+
+  switch (peek_class(p)) {
+  case CharClassOpenParenthesis:
+    string_slice_skip_characters(p, 1);
+    return (ParserItem){.type = ParserOpenParenthesisType};
+  case CharClassCloseParenthesis:
+    string_slice_skip_characters(p, 1);
+    return (ParserItem){.type = ParserCloseParenthesisType};
+  case CharClassOperator:
+    string_slice_skip_characters(p, 1);
+    return (ParserItem){
+        .type = ParserOperationType,
+        .operation = char_operation[(unsigned char)c],
+    };
+  case CharClassDigit:
+  case CharClassDot:
+    return lex_number(p);
+  case CharClassSpace:
+  case CharClassOther:
+    break;
+  }
+
+  return create_parser_error(p, ParserErrorNoMatches);
+}
+
+// Very fast random number generator, credits to Eskil Steenberg.
+// (http://www.gamepipeline.org/forge.html) Range is between 0 and 1
+static float randf(uint index) {
+  index = (index << 13) ^ index;
+  return (((index * (index * index * 15731 + 789221) + 1376312589) &
+           0x7fffffff) /
+          1073741824.0f) *
+         0.5f;
+}
+
+static uint64_t generate_seed(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec;
+}
+
+// https://prng.di.unimi.it/splitmix64.c, used to expand a 64-bit seed into
+// the 256 bits of xoshiro state.
+static uint64_t splitmix64_next(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+void parsedice_rng_seed(ParseDiceRng *rng, uint64_t seed) {
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(rng->s); i++)
+    rng->s[i] = splitmix64_next(&seed);
+}
+
+static inline uint64_t rotl64(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+// https://prng.di.unimi.it/xoshiro256starstar.c
+uint64_t parsedice_rng_next(ParseDiceRng *rng) {
+  PARSEDICE_COUNT(rng_calls, 1);
+
+  uint64_t *s = rng->s;
+  uint64_t result = rotl64(s[1] * 5, 7) * 9;
+  uint64_t t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+
+  s[2] ^= t;
+  s[3] = rotl64(s[3], 45);
+
+  return result;
+}
+
+// Threshold below which the low half of word * bound must be rejected for
+// multiply-shift mapping to be unbiased, i.e. 2^32 mod bound.
+static inline uint32_t bounded_threshold(uint32_t bound) {
+  return (uint32_t)(-bound) % bound;
+}
+
+// Uniform integer in [0, bound). bound must not be 0.
+// https://arxiv.org/abs/1805.10941
+uint32_t parsedice_rng_bounded(ParseDiceRng *rng, uint32_t bound) {
+  uint64_t m = (parsedice_rng_next(rng) >> 32) * (uint64_t)bound;
+
+  if ((uint32_t)m < bound) {
+    uint32_t threshold = bounded_threshold(bound);
+
+    while ((uint32_t)m < threshold)
+      m = (parsedice_rng_next(rng) >> 32) * (uint64_t)bound;
+  }
+
+  return (uint32_t)(m >> 32);
+}
+
+// Uniform double in (0, 1].
+static double rng_uniform_open(ParseDiceRng *rng) {
+  return ((parsedice_rng_next(rng) >> 11) + 1) * 0x1.0p-53;
+}
+
+static void rng_jump_with(ParseDiceRng *rng, const uint64_t jump[4]) {
+  uint64_t s[4] = {0};
+
+  for (size_t i = 0; i < 4; i++) {
+    for (int b = 0; b < 64; b++) {
+      if (jump[i] & (UINT64_C(1) << b)) {
+        for (size_t j = 0; j < 4; j++)
+          s[j] ^= rng->s[j];
+      }
+
+      parsedice_rng_next(rng);
+    }
+  }
+
+  memcpy(rng->s, s, sizeof(s));
+}
+
+// Advances the generator by 2^128 calls. Use it to hand out up to 2^128
+// non-overlapping streams from one seed.
+void parsedice_rng_jump(ParseDiceRng *rng) {
+  static const uint64_t jump[] = {0x180ec6d33cfd0aba, 0xd5a61266f0c9392c,
+                                  0xa9582618e03fc9aa, 0x39abdc4529b1661c};
+
+  rng_jump_with(rng, jump);
+}
+
+// Advances the generator by 2^192 calls.
+void parsedice_rng_long_jump(ParseDiceRng *rng) {
+  static const uint64_t jump[] = {0x76e15d3efefdcbbf, 0xc5004e441c522fb3,
+                                  0x77710069854ee241, 0x39109bb02acbe635};
+
+  rng_jump_with(rng, jump);
+}
+
+// Returns a generator for a new stream and moves rng past it.
+ParseDiceRng parsedice_rng_split(ParseDiceRng *rng) {
+  ParseDiceRng child = *rng;
+
+  parsedice_rng_jump(rng);
+
+  return child;
+}
+
+// Generator used by the functions that don't take one. It is thread-local,
+// so threads never contend on it, and it is seeded from the clock on first
+// use. Use an explicit ParseDiceRng for reproducible rolls.
+ParseDiceRng *parsedice_rng_default(void) {
+  static _Thread_local ParseDiceRng rng;
+  static _Thread_local bool seeded = false;
+
+  if (!seeded) {
+    parsedice_rng_seed(&rng, generate_seed() ^ (uint64_t)(uintptr_t)&rng);
+    seeded = true;
+  }
+
+  return &rng;
+}
+
+// Dice kernels map 32-bit random words to faces with multiply-shift:
+// face = (word * faces) >> 32, rejecting words whose low half falls below
+// threshold. They consume words in order until either `wanted` dice are
+// rolled or the words run out, add the zero-based faces to *sum and return
+// the number of dice rolled. Every kernel consumes the same words for the
+// same input, so the chosen instruction set never changes a result.
+typedef size_t (*RollKernel)(const uint32_t *words, size_t n_words,
+                             uint32_t faces, uint32_t threshold, size_t wanted,
+                             uint64_t *sum, size_t *consumed);
+
+static size_t roll_words_scalar(const uint32_t *words, size_t n_words,
+                                uint32_t faces, uint32_t threshold,
+                                size_t wanted, uint64_t *sum,
+                                size_t *consumed) {
+  size_t rolled = 0;
+  size_t i = 0;
+
+  for (; i < n_words && rolled < wanted; i++) {
+    uint64_t m = (uint64_t)words[i] * faces;
+
+    if ((uint32_t)m < threshold)
+      continue;
+
+    *sum += m >> 32;
+    rolled++;
+  }
+
+  *consumed = i;
+
+  return rolled;
+}
+
+#ifdef PARSEDICE_X86_SIMD
+__attribute__((target("sse2"))) static size_t
+roll_words_sse2(const uint32_t *words, size_t n_words, uint32_t faces,
+                uint32_t threshold, size_t wanted, uint64_t *sum,
+                size_t *consumed) {
+  const __m128i f = _mm_set1_epi32((int)faces);
+  const __m128i sign = _mm_set1_epi32(INT32_MIN);
+  const __m128i thr = _mm_xor_si128(_mm_set1_epi32((int)threshold), sign);
+  const __m128i low_mask = _mm_set_epi32(0, -1, 0, -1);
+  __m128i acc = _mm_setzero_si128();
+
+  size_t rolled = 0;
+  size_t i = 0;
+
+  for (; i + 4 <= n_words && rolled + 4 <= wanted; i += 4) {
+    __m128i w = _mm_loadu_si128((const __m128i *)&words[i]);
+    __m128i even = _mm_mul_epu32(w, f);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(w, 32), f);
+
+    __m128i lows =
+        _mm_or_si128(_mm_and_si128(even, low_mask), _mm_slli_epi64(odd, 32));
+    __m128i rejected = _mm_cmplt_epi32(_mm_xor_si128(lows, sign), thr);
+
+    if (_mm_movemask_epi8(rejected) != 0) {
+      size_t used;
+      rolled += roll_words_scalar(&words[i], 4, faces, threshold, 4, sum,
+                                  &used);
+      continue;
+    }
+
+    acc = _mm_add_epi64(acc, _mm_srli_epi64(even, 32));
+    acc = _mm_add_epi64(acc, _mm_srli_epi64(odd, 32));
+    rolled += 4;
+  }
+
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, acc);
+  *sum += lanes[0] + lanes[1];
+
+  size_t used;
+  rolled += roll_words_scalar(&words[i], n_words - i, faces, threshold,
+                              wanted - rolled, sum, &used);
+  *consumed = i + used;
+
+  return rolled;
+}
+
+__attribute__((target("avx2"))) static size_t
+roll_words_avx2(const uint32_t *words, size_t n_words, uint32_t faces,
+                uint32_t threshold, size_t wanted, uint64_t *sum,
+                size_t *consumed) {
+  const __m256i f = _mm256_set1_epi32((int)faces);
+  const __m256i sign = _mm256_set1_epi32(INT32_MIN);
+  const __m256i thr =
+      _mm256_xor_si256(_mm256_set1_epi32((int)threshold), sign);
+  const __m256i low_mask = _mm256_set1_epi64x(0xffffffff);
+  __m256i acc = _mm256_setzero_si256();
+
+  size_t rolled = 0;
+  size_t i = 0;
+
+  for (; i + 8 <= n_words && rolled + 8 <= wanted; i += 8) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)&words[i]);
+    __m256i even = _mm256_mul_epu32(w, f);
+    __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(w, 32), f);
+
+    __m256i lows = _mm256_or_si256(_mm256_and_si256(even, low_mask),
+                                   _mm256_slli_epi64(odd, 32));
+    __m256i rejected = _mm256_cmpgt_epi32(thr, _mm256_xor_si256(lows, sign));
+
+    if (_mm256_movemask_epi8(rejected) != 0) {
+      size_t used;
+      rolled += roll_words_scalar(&words[i], 8, faces, threshold, 8, sum,
+                                  &used);
+      continue;
+    }
+
+    acc = _mm256_add_epi64(acc, _mm256_srli_epi64(even, 32));
+    acc = _mm256_add_epi64(acc, _mm256_srli_epi64(odd, 32));
+    rolled += 8;
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i *)lanes, acc);
+  *sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+  size_t used;
+  rolled += roll_words_scalar(&words[i], n_words - i, faces, threshold,
+                              wanted - rolled, sum, &used);
+  *consumed = i + used;
+
+  return rolled;
+}
+#endif
+
+// __builtin_cpu_supports only reads data the runtime filled in at startup,
+// so asking on every call is cheap and needs no shared mutable state.
+static RollKernel roll_kernel_select(void) {
+#ifdef PARSEDICE_X86_SIMD
+  if (__builtin_cpu_supports("avx2"))
+    return roll_words_avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return roll_words_sse2;
+#endif
+  return roll_words_scalar;
+}
+
+// Fills words with fresh 32-bit random words, two per generator call.
+static void rng_fill_words(ParseDiceRng *rng, uint32_t *words, size_t n) {
+  for (size_t i = 0; i + 1 < n; i += 2) {
+    uint64_t x = parsedice_rng_next(rng);
+
+    words[i] = (uint32_t)x;
+    words[i + 1] = (uint32_t)(x >> 32);
+  }
+}
+
+// Rolls n <= PARSEDICE_ROLL_BUFFER_WORDS zero-based faces into out.
+static void roll_faces(ParseDiceRng *rng, DiceInt faces, uint32_t threshold,
+                       uint32_t *out, size_t n) {
+  uint32_t words[PARSEDICE_ROLL_BUFFER_WORDS];
+  size_t rolled = 0;
+
+  while (rolled < n) {
+    size_t wanted = n - rolled;
+    size_t n_words = wanted + (wanted & 1);
+
+    rng_fill_words(rng, words, n_words);
+
+    for (size_t i = 0; i < n_words && rolled < n; i++) {
+      uint64_t m = (uint64_t)words[i] * faces;
+
+      if ((uint32_t)m >= threshold)
+        out[rolled++] = (uint32_t)(m >> 32);
+    }
+  }
+}
+
+// The lexer rejects rerolls covering every face. Dice built by hand with
+// one roll nothing, like dice without faces, rather than underflowing
+// faces - reroll.
+static bool dice_rolls_nothing(Dice d) { return d.reroll >= d.faces; }
+
+// The lexer makes keeping at least as many dice as are rolled a plain
+// roll. Dice built by hand get the same treatment here, so keep_count
+// never exceeds amount past the entry points.
+static Dice dice_normalize_keep(Dice d) {
+  if (d.keep != DiceKeepAll && d.keep_count >= d.amount) {
+    d.keep = DiceKeepAll;
+    d.keep_count = 0;
+  }
+
+  return d;
+}
+
+// The smallest and largest values one die of d can show.
+static uint64_t dice_die_min(Dice d) { return (uint64_t)d.reroll + 1; }
+
+static uint64_t dice_die_max(Dice d) {
+  return d.explode ? (uint64_t)d.faces * (PARSEDICE_EXPLODE_CAP + 1) : d.faces;
+}
+
+// Finishes an exploding die whose first draw showed the top face, and
+// returns what the rest of the chain adds. Each further draw shows the top
+// face with chance 1/n, so the length of the run is geometric and is drawn
+// with one logarithm instead of a loop. The draw that ends the run shows
+// any face below the top, or any face at all once the die hits the cap.
+static uint64_t explode_tail(ParseDiceRng *rng, Dice d, double log_n) {
+  uint32_t n = d.faces - d.reroll;
+  uint64_t more = PARSEDICE_EXPLODE_CAP - 1;
+
+  if (n > 1) {
+    double run = floor(log(rng_uniform_open(rng)) / -log_n);
+
+    if (run < (double)more)
+      more = (uint64_t)run;
+  }
+
+  uint32_t last = more < PARSEDICE_EXPLODE_CAP - 1
+                      ? parsedice_rng_bounded(rng, n - 1)
+                      : parsedice_rng_bounded(rng, n);
+
+  return more * d.faces + dice_die_min(d) + last;
+}
+
+// Rolls n <= PARSEDICE_ROLL_BUFFER_WORDS dice of d into out, each minus the
+// smallest value a die can show.
+static void roll_values(ParseDiceRng *rng, Dice d, uint32_t threshold,
+                        uint64_t *out, size_t n) {
+  uint32_t faces[PARSEDICE_ROLL_BUFFER_WORDS];
+  uint32_t top = d.faces - d.reroll - 1;
+  double log_n = log((double)top + 1);
+
+  roll_faces(rng, top + 1, threshold, faces, n);
+
+  for (size_t i = 0; i < n; i++) {
+    out[i] = faces[i];
+
+    if (d.explode && PARSEDICE_EXPLODE_CAP > 0 && faces[i] == top)
+      out[i] += explode_tail(rng, d, log_n);
+  }
+}
+
+// Sums the kept dice without sorting or storing them. Each die is ranked
+// so that the dice to keep rank highest, and ranks are counted into
+// PARSEDICE_SELECT_BUCKETS buckets. Whole buckets above the cut-off are
+// summed, and the bucket holding it is split again by rolling the same
+// dice from a copy of the generator. Up to PARSEDICE_SELECT_BUCKETS values
+// that is one counting pass, and never more than five passes: linear time
+// and constant memory.
+static ParserConstNum dice_roll_keep(ParseDiceRng *rng, Dice d,
+                                     ParserConstNum results[]) {
+  uint32_t threshold = bounded_threshold(d.faces - d.reroll);
+  bool highest = d.keep == DiceKeepHighest;
+
+  uint64_t min = dice_die_min(d);
+  uint64_t top = dice_die_max(d) - min;
+
+  uint64_t values[PARSEDICE_ROLL_BUFFER_WORDS];
+  uint32_t counts[PARSEDICE_SELECT_BUCKETS];
+  uint64_t sums[PARSEDICE_SELECT_BUCKETS];
+
+  // Ranks in [low, low + span) are still undecided.
+  uint64_t low = 0, span = top + 1;
+  uint64_t needed = d.keep_count;
+  uint64_t kept = 0;
+
+  ParseDiceRng start = *rng;
+  bool first_pass = true;
+
+  do {
+    ParseDiceRng pass = start;
+    uint64_t width = (span + PARSEDICE_SELECT_BUCKETS - 1) /
+                     PARSEDICE_SELECT_BUCKETS;
+
+    memset(counts, 0, sizeof(counts));
+    memset(sums, 0, sizeof(sums));
+
+    for (size_t done = 0; done < d.amount;) {
+      size_t n = d.amount - done < PARSEDICE_ROLL_BUFFER_WORDS
+                     ? d.amount - done
+                     : PARSEDICE_ROLL_BUFFER_WORDS;
+
+      roll_values(&pass, d, threshold, values, n);
+
+      for (size_t i = 0; i < n; i++) {
+        if (first_pass && results != NULL)
+          results[done + i] = (ParserConstNum)(values[i] + min);
+
+        uint64_t rank = highest ? values[i] : top - values[i];
+
+        if (rank < low || rank - low >= span)
+          continue;
+
+        size_t b = (size_t)((rank - low) / width);
+        counts[b]++;
+        sums[b] += rank;
+      }
+
+      done += n;
+    }
+
+    *rng = pass;
+    first_pass = false;
+
+    for (size_t b = PARSEDICE_SELECT_BUCKETS; needed > 0 && b-- > 0;) {
+      if (counts[b] <= needed) {
+        kept += sums[b];
+        needed -= counts[b];
+        continue;
+      }
+
+      if (width == 1) {
+        kept += needed * (low + b);
+        needed = 0;
+        break;
+      }
+
+      span = span - b * width < width ? span - b * width : width;
+      low += b * width;
+      break;
+    }
+  } while (needed > 0);
+
+  // Ranks are values above the smallest, or counted down from the top.
+  uint64_t k = d.keep_count;
+
+  return (ParserConstNum)(k * min + (highest ? kept : k * top - kept));
+}
+
+// Sums a pool of exploding dice that are all kept.
+static ParserConstNum dice_roll_explode(ParseDiceRng *rng, Dice d,
+                                        ParserConstNum results[]) {
+  uint32_t threshold = bounded_threshold(d.faces - d.reroll);
+  uint64_t min = dice_die_min(d);
+  uint64_t values[PARSEDICE_ROLL_BUFFER_WORDS];
+  uint64_t sum = 0;
+
+  for (size_t done = 0; done < d.amount;) {
+    size_t n = d.amount - done < PARSEDICE_ROLL_BUFFER_WORDS
+                   ? d.amount - done
+                   : PARSEDICE_ROLL_BUFFER_WORDS;
+
+    roll_values(rng, d, threshold, values, n);
+
+    for (size_t i = 0; i < n; i++) {
+      if (results != NULL)
+        results[done + i] = (ParserConstNum)(values[i] + min);
+
+      sum += values[i];
+    }
+
+    done += n;
+  }
+
+  return (ParserConstNum)(sum + d.amount * min);
+}
+
+// The chance that one die of a success-counting term is a success.
+static double dice_success_chance(Dice d) {
+  uint64_t low = dice_die_min(d), high = d.faces;
+
+  if (d.count == DiceCountAtLeast && d.target > low)
+    low = d.target;
+  if (d.count == DiceCountAtMost && d.target < high)
+    high = d.target;
+
+  return low > high ? 0 : (double)(high - low + 1) / (d.faces - d.reroll);
+}
+
+// log(k!) - log(sqrt(2 pi k) (k / e)^k), the error of Stirling's formula.
+static double stirling_tail(double k) {
+  static const double small[] = {
+      0.0810614667953272,  0.0413406959554092,  0.0276779256849983,
+      0.02079067210376509, 0.0166446911898211,  0.0138761288230707,
+      0.0118967099458917,  0.0104112652619720,  0.00925546218271273,
+      0.00833056343336287,
+  };
+
+  if (k < (double)PARSEDICE_ARRAY_SIZE(small))
+    return small[(size_t)k];
+
+  double kp1 = k + 1, kp1sq = kp1 * kp1;
+
+  return (1.0 / 12 - (1.0 / 360 - 1.0 / 1260 / kp1sq) / kp1sq) / kp1;
+}
+
+// Draws from the binomial distribution with n trials of chance p <= 1/2.
+// Below ten expected successes the gaps between successes are summed as
+// geometric draws. Above, Hormann's BTRS transformed rejection accepts
+// about nine draws in ten from a squeeze and the rest from a bound on the
+// exact log probability, so the cost doesn't grow with n.
+static uint64_t rng_binomial_half(ParseDiceRng *rng, uint64_t n, double p) {
+  if (p <= 0)
+    return 0;
+
+  if (n * p < 10) {
+    double log_q = log1p(-p);
+    uint64_t successes = 0;
+    double position = 0;
+
+    for (;;) {
+      double gap = ceil(log(rng_uniform_open(rng)) / log_q);
+      position += gap < 1 ? 1 : gap;
+
+      if (position > (double)n)
+        return successes;
+
+      successes++;
+    }
+  }
+
+  double q = 1 - p;
+  double spread = sqrt(n * p * q);
+  double b = 1.15 + 2.53 * spread;
+  double a = -0.0873 + 0.0248 * b + 0.01 * p;
+  double c = n * p + 0.5;
+  double v_r = 0.92 - 4.2 / b;
+  double r = p / q;
+  double alpha = (2.83 + 5.1 / b) * spread;
+  double m = floor((n + 1) * p);
+
+  for (;;) {
+    double u = (parsedice_rng_next(rng) >> 11) * 0x1.0p-53 - 0.5;
+    double v = (parsedice_rng_next(rng) >> 11) * 0x1.0p-53;
+    double us = 0.5 - fabs(u);
+    double k = floor((2 * a / us + b) * u + c);
+
+    if (k < 0 || k > (double)n)
+      continue;
+
+    if (us >= 0.07 && v <= v_r)
+      return (uint64_t)k;
+
+    v = log(v * alpha / (a / (us * us) + b));
+
+    double bound = (m + 0.5) * log((m + 1) / (r * (n - m + 1))) +
+                   (n + 1) * log((n - m + 1) / (n - k + 1)) +
+                   (k + 0.5) * log(r * (n - k + 1) / (k + 1)) +
+                   stirling_tail(m) + stirling_tail(n - m) -
+                   stirling_tail(k) - stirling_tail(n - k);
+
+    if (v <= bound)
+      return (uint64_t)k;
+  }
+}
+
+static uint64_t rng_binomial(ParseDiceRng *rng, uint64_t n, double p) {
+  return p > 0.5 ? n - rng_binomial_half(rng, n, 1 - p)
+                 : rng_binomial_half(rng, n, p);
+}
+
+// Counts the successes of a success-counting term. Without a log the count
+// is one binomial draw; with one, every die is rolled and logged.
+static ParserConstNum dice_roll_count(ParseDiceRng *rng, Dice d,
+                                      ParserConstNum results[]) {
+  if (results == NULL) {
+    PARSEDICE_STAGE_BEGIN(Roll);
+    PARSEDICE_COUNT(dice_rolled, d.amount);
+
+    uint64_t successes = rng_binomial(rng, d.amount, dice_success_chance(d));
+
+    PARSEDICE_STAGE_END(Roll);
+
+    return (ParserConstNum)successes;
+  }
+
+  Dice plain = d;
+  plain.count = DiceCountNone;
+  parsedice_dice_roll_rng(rng, plain, results);
+
+  uint64_t successes = 0;
+
+  for (size_t i = 0; i < d.amount; i++)
+    successes += d.count == DiceCountAtLeast ? results[i] >= d.target
+                                             : results[i] <= d.target;
+
+  return (ParserConstNum)successes;
+}
+
+ParserConstNum parsedice_dice_roll_rng(ParseDiceRng *rng, Dice d,
+                                       ParserConstNum results[]) {
+  if (dice_rolls_nothing(d))
+    return 0;
+
+  d = dice_normalize_keep(d);
+
+  if (d.count != DiceCountNone)
+    return dice_roll_count(rng, d, results);
+
+  if (d.keep != DiceKeepAll || d.explode) {
+    PARSEDICE_STAGE_BEGIN(Roll);
+    PARSEDICE_COUNT(dice_rolled, d.amount);
+
+    ParserConstNum sum = d.keep != DiceKeepAll
+                             ? dice_roll_keep(rng, d, results)
+                             : dice_roll_explode(rng, d, results);
+
+    PARSEDICE_STAGE_END(Roll);
+
+    return sum;
+  }
+
+  PARSEDICE_STAGE_BEGIN(Roll);
+  PARSEDICE_COUNT(dice_rolled, d.amount);
+
+  // Rerolling the low faces until they don't come up is a roll of the
+  // faces that are left.
+  uint32_t faces = d.faces - d.reroll;
+  uint64_t min = dice_die_min(d);
+
+  uint32_t words[PARSEDICE_ROLL_BUFFER_WORDS];
+  uint32_t threshold = bounded_threshold(faces);
+  RollKernel kernel = roll_kernel_select();
+
+  uint64_t sum = 0;
+  size_t rolled = 0;
+
+  while (rolled < d.amount) {
+    size_t wanted = d.amount - rolled;
+
+    // Draw an even number of words, enough for every remaining die unless
+    // some are rejected.
+    size_t n_words = wanted + (wanted & 1);
+    if (n_words > PARSEDICE_ROLL_BUFFER_WORDS)
+      n_words = PARSEDICE_ROLL_BUFFER_WORDS;
+
+    rng_fill_words(rng, words, n_words);
+
+    if (results == NULL) {
+      size_t consumed;
+      rolled +=
+          kernel(words, n_words, faces, threshold, wanted, &sum, &consumed);
+      continue;
+    }
+
+    for (size_t i = 0; i < n_words && rolled < d.amount; i++) {
+      uint64_t m = (uint64_t)words[i] * faces;
+
+      if ((uint32_t)m < threshold)
+        continue;
+
+      results[rolled++] = (ParserConstNum)((m >> 32) + min);
+      sum += m >> 32;
+    }
+  }
+
+  PARSEDICE_STAGE_END(Roll);
+
+  // Kernels sum zero-based faces, add the smallest face of every die at
+  // once.
+  return (ParserConstNum)(sum + d.amount * min);
+}
+
+ParserConstNum parsedice_dice_roll(Dice d, ParserConstNum results[]) {
+  return parsedice_dice_roll_rng(parsedice_rng_default(), d, results);
+}
+
+// Rolls d and writes how many dice showed each face, counts[i] being the
+// dice that showed i + 1, into the first d.faces entries of counts. Dice
+// dropped by keep/drop aren't counted. The counts follow a multinomial
+// distribution, drawn face by face as the binomial share of the dice that
+// didn't show an earlier face, so the cost is O(faces) however many dice
+// are rolled. Exploding dice don't show a single face and are
+// ParseDiceErrorUnsupported.
+ParseDiceStatus parsedice_dice_roll_counts(ParseDiceRng *rng, Dice d,
+                                           uint64_t counts[],
+                                           size_t counts_length) {
+  if (d.explode)
+    return ParseDiceErrorUnsupported;
+
+  if (counts_length < d.faces)
+    return ParseDiceErrorTooLarge;
+
+  d = dice_normalize_keep(d);
+
+  PARSEDICE_STAGE_BEGIN(Roll);
+  PARSEDICE_COUNT(dice_rolled, d.amount);
+
+  uint64_t left = d.amount;
+
+  for (size_t face = 0; face < d.faces; face++) {
+    if (face < d.reroll || left == 0) {
+      counts[face] = 0;
+      continue;
+    }
+
+    counts[face] = face + 1 == d.faces
+                       ? left
+                       : rng_binomial(rng, left, 1.0 / (d.faces - face));
+    left -= counts[face];
+  }
+
+  if (d.keep != DiceKeepAll) {
+    uint64_t keep = d.keep_count;
+
+    for (size_t i = 0; i < d.faces; i++) {
+      size_t face = d.keep == DiceKeepHighest ? d.faces - 1 - i : i;
+
+      if (counts[face] > keep)
+        counts[face] = keep;
+
+      keep -= counts[face];
+    }
+  }
+
+  PARSEDICE_STAGE_END(Roll);
+
+  return ParseDiceOk;
+}
+
+static ParseDiceExpression parse_slice_in(ParseDiceArena *arena,
+                                          StringSlice p) {
+  PARSEDICE_STAGE_BEGIN(Parse);
+
+  ParseDiceExpression e = expression_create_in(arena);
+
+  for (;;) {
+    ParserItem item = lex_item(&p);
+
+    if (item.type == ParserNullType)
+      break;
+
+    parsedice_expression_append(&e, item);
+
+    if (item.type == ParserErrorType)
+      break;
+  }
+
+  PARSEDICE_STAGE_END(Parse);
+
+  return e;
+}
+
+ParseDiceExpression parsedice_parse_slice(StringSlice slice) {
+  return parse_slice_in(NULL, slice);
+}
+
+ParseDiceExpression parsedice_parse_string(const char *string) {
+  return parse_slice_in(NULL, string_slice_from_c_str(string));
+}
+
+// Binding powers for the postfix parser. A left-associative operation has
+// right = left + 1, a right-associative one would use right = left.
+typedef struct {
+  unsigned char left;
+  unsigned char right;
+} BindingPower;
+
+static const BindingPower infix_binding_power[] = {
+    [ParserOperationAdd] = {1, 2},
+    [ParserOperationSub] = {1, 2},
+    [ParserOperationMul] = {3, 4},
+    [ParserOperationDiv] = {3, 4},
+};
+
+// Unary + and - bind tighter than any infix operation.
+#define PARSEDICE_PREFIX_BINDING_POWER 5
+
+typedef struct {
+  StringSlice input;
+
+  // Current token and where it starts.
+  ParserItem token;
+  StringSlice token_at;
+
+  ParseDiceExpression *out;
+  size_t depth;
+} PrattParser;
+
+static void pratt_advance(PrattParser *ps) {
+  skip_whitespace(&ps->input);
+
+  ps->token_at = ps->input;
+  ps->token = lex_item(&ps->input);
+}
+
+static bool pratt_fail(PrattParser *ps, ParserItem error) {
+  parsedice_expression_append(ps->out, error);
+  return false;
+}
+
+static bool pratt_fail_at(PrattParser *ps, ParserErrorEnum error) {
+  return pratt_fail(ps, create_parser_error(&ps->token_at, error));
+}
+
+// Precedence climbing. Operands are emitted as soon as they are read and
+// each operation right after its right-hand side, which is postfix order.
+static bool pratt_parse(PrattParser *ps, unsigned char min_bp) {
+  if (++ps->depth > PARSEDICE_MAX_NESTING)
+    return pratt_fail_at(ps, ParserErrorTooDeep);
+
+  ParserItem token = ps->token;
+
+  switch (token.type) {
+  case ParserDiceType:
+  case ParserConstNumType:
+    pratt_advance(ps);
+    parsedice_expression_append(ps->out, token);
+    break;
+  case ParserOpenParenthesisType:
+    pratt_advance(ps);
+
+    if (!pratt_parse(ps, 0))
+      return false;
+
+    if (ps->token.type != ParserCloseParenthesisType)
+      return pratt_fail_at(ps, ParserErrorUnbalancedParenthesis);
+
+    pratt_advance(ps);
+    break;
+  case ParserOperationType:
+    if (token.operation != ParserOperationAdd &&
+        token.operation != ParserOperationSub)
+      return pratt_fail_at(ps, ParserErrorExpectedOperand);
+
+    pratt_advance(ps);
+
+    // -x is emitted as 0 x -, so evaluators only ever see binary operations.
+    if (token.operation == ParserOperationSub)
+      parsedice_expression_append(
+          ps->out, (ParserItem){.type = ParserConstNumType, .number = 0});
+
+    if (!pratt_parse(ps, PARSEDICE_PREFIX_BINDING_POWER))
+      return false;
+
+    if (token.operation == ParserOperationSub)
+      parsedice_expression_append(ps->out, token);
+    break;
+  case ParserErrorType:
+    return pratt_fail(ps, token);
+  default:
+    return pratt_fail_at(ps, ParserErrorExpectedOperand);
+  }
+
+  for (;;) {
+    token = ps->token;
+
+    if (token.type == ParserNullType ||
+        token.type == ParserCloseParenthesisType)
+      break;
+
+    if (token.type == ParserErrorType)
+      return pratt_fail(ps, token);
+
+    if (token.type != ParserOperationType)
+      return pratt_fail_at(ps, ParserErrorExpectedOperator);
+
+    BindingPower bp = infix_binding_power[token.operation];
+
+    if (bp.left < min_bp)
+      break;
+
+    pratt_advance(ps);
+
+    if (!pratt_parse(ps, bp.right))
+      return false;
+
+    parsedice_expression_append(ps->out, token);
+  }
+
+  ps->depth--;
+
+  return true;
+}
+
+// Parses straight into postfix, with the same error reporting as
+// parsedice_parse_string: on failure the last item is a ParserErrorType.
+static ParseDiceExpression parse_slice_postfix_in(ParseDiceArena *arena,
+                                                  StringSlice p) {
+  PARSEDICE_STAGE_BEGIN(Parse);
+
+  ParseDiceExpression e = expression_create_in(arena);
+
+  PrattParser ps = {.input = p, .out = &e};
+
+  pratt_advance(&ps);
+
+  if (ps.token.type != ParserNullType && pratt_parse(&ps, 0) &&
+      ps.token.type == ParserCloseParenthesisType)
+    pratt_fail_at(&ps, ParserErrorUnbalancedParenthesis);
+
+  PARSEDICE_STAGE_END(Parse);
+
+  return e;
+}
+
+ParseDiceExpression parsedice_parse_slice_postfix(StringSlice slice) {
+  return parse_slice_postfix_in(NULL, slice);
+}
+
+ParseDiceExpression parsedice_parse_string_postfix(const char *string) {
+  return parse_slice_postfix_in(NULL, string_slice_from_c_str(string));
+}
+
+static const char *const error_str[] = {
+    [ParserErrorExpectedInt] = "Expected Int",
+    [ParserErrorDidNotMatchPattern] =
+        "This error should never be logged, internal error",
+    [ParserErrorNoMatches] = "No types have matched, please check your input",
+    [ParserErrorNumberTooLarge] = "Number is too large",
+    [ParserErrorExpectedOperand] = "Expected a dice, number or parenthesis",
+    [ParserErrorExpectedOperator] = "Expected an operation",
+    [ParserErrorUnbalancedParenthesis] = "Unbalanced parenthesis",
+    [ParserErrorTooDeep] = "Expression is nested too deeply",
+    [ParserErrorExpectedModifier] = "Expected kh, kl, dh or dl and a count",
+    [ParserErrorRerollAll] = "Reroll covers every face",
+    [ParserErrorCountModifier] =
+        "Success counting can't be combined with ! or keep/drop",
+    [ParserErrorOutOfMemory] = "Out of memory",
+};
+
+const char *parsedice_parse_error_to_string(ParserError error) {
+  return error_str[error.type];
+}
+
+char parsedice_operation_to_char(ParserOperation type) {
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(op_mappings); i++) {
+    if (type == op_mappings[i].type)
+      return op_mappings[i].character;
+  }
+
+  return '?';
+}
+
+struct ParserItemStack {
+  size_t length;
+  size_t capacity;
+  ParserItem items[];
+};
+
+// Returns NULL when out of memory; the functions taking a stack report
+// that as a ParserErrorOutOfMemory item.
+static ParserItemStack *parser_item_stack_create() {
+  PARSEDICE_COUNT(allocations, 1);
+
+  ParserItemStack *s =
+      PARSEDICE_MALLOC(sizeof(ParserItemStack) +
+             PARSEDICE_DEFAULT_STACK_SIZE * sizeof(ParserItem));
+
+  if (s == NULL)
+    return NULL;
+
+  s->length = 0;
+  s->capacity = PARSEDICE_DEFAULT_STACK_SIZE;
+
+  return s;
+}
+
+static void parser_item_stack_destroy(ParserItemStack *s) {
+  PARSEDICE_FREE(s);
+
+  s = NULL;
+}
+
+// Takes the caller's pointer because growing the stack may move it.
+// Returns false, leaving the stack as it was, if it can't grow.
+static bool parser_item_stack_push(ParserItemStack **sp, ParserItem i) {
+  ParserItemStack *s = *sp;
+
+  if (s == NULL)
+    return false;
+
+  if (s->length + 1 > s->capacity) {
+    s = PARSEDICE_REALLOC(s,
+                sizeof(ParserItemStack) + sizeof(ParserItem) * s->capacity * 2);
+
+    if (s == NULL)
+      return false;
+
+    s->capacity *= 2;
+    *sp = s;
+
+    PARSEDICE_COUNT(reallocations, 1);
+  }
+
+  s->items[s->length] = i;
+  s->length++;
+
+  return true;
+}
+
+static ParserItem parser_item_stack_pop(ParserItemStack *s) {
+  if (s->length <= 0)
+    return (ParserItem){.type = ParserNullType};
+
+  return s->items[--s->length];
+}
+
+static ParserItem parser_item_stack_peek(ParserItemStack *s) {
+  if (s->length <= 0)
+    return (ParserItem){.type = ParserNullType};
+
+  return s->items[s->length - 1];
+}
+
+// Only parentheses are ever on the stack here, so a depth is enough and
+// there is nothing to allocate.
+bool parsedice_expression_is_balanced(ParseDiceExpression ex) {
+  size_t depth = 0;
+
+  for (size_t i = 0; i < ex.length; ++i) {
+    ParserItem item = ex.items[i];
+
+    if (item.type == ParserOpenParenthesisType)
+      depth++;
+
+    if (item.type == ParserCloseParenthesisType) {
+      if (depth == 0)
+        return false;
+
+      depth--;
+    }
+  }
+
+  return depth == 0;
+}
+
+static ParserItem out_of_memory_error(void) {
+  StringSlice nowhere = {0};
+
+  return create_parser_error(&nowhere, ParserErrorOutOfMemory);
+}
+
+static const uint precedence_table[] = {
+    [ParserOperationAdd] = 1,
+    [ParserOperationSub] = 1,
+    [ParserOperationMul] = 2,
+    [ParserOperationDiv] = 2,
+};
+
+// https://compileralchemy.substack.com/p/step-by-step-parsing-of-mathematical
+static ParseDiceExpression expression_to_postfix_with(ParserItemStack **s,
+                                                      ParseDiceArena *arena,
+                                                      ParseDiceExpression e) {
+  PARSEDICE_STAGE_BEGIN(ToPostfix);
+
+  ParserItemStack **operator_stack = s;
+  ParseDiceExpression output = expression_create_in(arena);
+  bool pushed = *operator_stack != NULL;
+
+  if (!pushed)
+    goto end;
+
+  (*operator_stack)->length = 0;
+
+  for (size_t i = 0; i < e.length && pushed; i++) {
+    ParserItem token = e.items[i];
+
+    switch (token.type) {
+    case ParserDiceType:
+    case ParserConstNumType:
+      parsedice_expression_append(&output, token);
+      break;
+    case ParserOperationType:
+      while ((*operator_stack)->length > 0) {
+        ParserItem on_top = parser_item_stack_peek(*operator_stack);
+
+        if (on_top.type != ParserOperationType ||
+            precedence_table[on_top.operation] <
+                precedence_table[token.operation])
+          break;
+
+        parsedice_expression_append(&output,
+                                    parser_item_stack_pop(*operator_stack));
+      }
+
+      pushed = parser_item_stack_push(operator_stack, token);
+      break;
+    case ParserOpenParenthesisType:
+      pushed = parser_item_stack_push(operator_stack, token);
+      break;
+    case ParserCloseParenthesisType:
+      while ((*operator_stack)->length > 0) {
+        ParserItem on_top = parser_item_stack_peek(*operator_stack);
+
+        if (on_top.type == ParserOpenParenthesisType) {
+          parser_item_stack_pop(*operator_stack);
+          break;
+        } else {
+          parsedice_expression_append(&output,
+                                      parser_item_stack_pop(*operator_stack));
+        }
+      }
+      break;
+    default:
+      pushed = parser_item_stack_push(operator_stack, token);
+      break;
+    }
+  }
+
+  while (pushed && (*operator_stack)->length > 0) {
+    parsedice_expression_append(&output, parser_item_stack_pop(*operator_stack));
+  }
+
+end:
+  // Like a parse error, the failure is the last item.
+  if (!pushed)
+    parsedice_expression_append(&output, out_of_memory_error());
+
+  PARSEDICE_STAGE_END(ToPostfix);
+
+  return output;
+}
+
+ParseDiceExpression parsedice_expression_to_postfix(ParseDiceExpression e) {
+  ParserItemStack *s = parser_item_stack_create();
+
+  ParseDiceExpression output = expression_to_postfix_with(&s, NULL, e);
+
+  parser_item_stack_destroy(s);
+
+  return output;
+}
+
+#ifdef PARSEDICE_NUMBER_INT64
+// Computed on unsigned values, so overflow wraps instead of being undefined.
+static ParserConstNum handle_add(ParserConstNum left, ParserConstNum right) {
+  return (ParserConstNum)((uint64_t)left + (uint64_t)right);
+}
+
+static ParserConstNum handle_sub(ParserConstNum left, ParserConstNum right) {
+  return (ParserConstNum)((uint64_t)left - (uint64_t)right);
+}
+
+static ParserConstNum handle_mul(ParserConstNum left, ParserConstNum right) {
+  return (ParserConstNum)((uint64_t)left * (uint64_t)right);
+}
+
+// Rounds toward negative infinity, so (0 - 7) / 2 is -4 like floor(-3.5).
+static ParserConstNum handle_div(ParserConstNum left, ParserConstNum right) {
+  if (right == 0)
+    return 0;
+
+  // INT64_MIN / -1 overflows.
+  if (right == -1)
+    return handle_sub(0, left);
+
+  ParserConstNum quotient = left / right;
+
+  if (left % right != 0 && (left < 0) != (right < 0))
+    quotient--;
+
+  return quotient;
+}
+#else
+static ParserConstNum handle_add(ParserConstNum left, ParserConstNum right) {
+  return left + right;
+}
+
+static ParserConstNum handle_sub(ParserConstNum left, ParserConstNum right) {
+  return left - right;
+}
+
+static ParserConstNum handle_mul(ParserConstNum left, ParserConstNum right) {
+  return left * right;
+}
+
+static ParserConstNum handle_div(ParserConstNum left, ParserConstNum right) {
+  // TODO: Handle divide by zero
+  return left / right;
+}
+#endif
+
+static ParserConstNum (*const op_handlers[])(ParserConstNum, ParserConstNum) = {
+    [ParserOperationAdd] = handle_add,
+    [ParserOperationSub] = handle_sub,
+    [ParserOperationMul] = handle_mul,
+    [ParserOperationDiv] = handle_div,
+};
+
+// Column-wise versions of the handlers above, used by batch evaluation. They
+// apply the scalar handler across a whole block so the loops vectorize.
+#define PARSEDICE_DEFINE_BLOCK_HANDLER(name)                                   \
+  static void name##_block(ParserConstNum *restrict left,                     \
+                           const ParserConstNum *restrict right, size_t n) {  \
+    for (size_t i = 0; i < n; i++)                                             \
+      left[i] = name(left[i], right[i]);                                       \
+  }
+
+PARSEDICE_DEFINE_BLOCK_HANDLER(handle_add)
+PARSEDICE_DEFINE_BLOCK_HANDLER(handle_sub)
+PARSEDICE_DEFINE_BLOCK_HANDLER(handle_mul)
+PARSEDICE_DEFINE_BLOCK_HANDLER(handle_div)
+
+#undef PARSEDICE_DEFINE_BLOCK_HANDLER
+
+static void (*const op_block_handlers[])(ParserConstNum *restrict,
+                                         const ParserConstNum *restrict,
+                                         size_t) = {
+    [ParserOperationAdd] = handle_add_block,
+    [ParserOperationSub] = handle_sub_block,
+    [ParserOperationMul] = handle_mul_block,
+    [ParserOperationDiv] = handle_div_block,
+};
+
+static ParserItem handle_operation(ParseDiceExpression e, size_t idx, ParserItemStack *s, ParserOperation op) {
+  ParserItem right = parser_item_stack_pop(s);
+  ParserItem left = parser_item_stack_pop(s);
+
+  return (ParserItem){.type = ParserConstNumType,
+                      .number = op_handlers[op](left.number, right.number)};
+}
+
+ParserItem parsedice_expression_evaluate(ParseDiceExpression e) {
+  return parsedice_expression_evaluate_rng(parsedice_rng_default(), e);
+}
+
+ParserItem parsedice_expression_evaluate_rng(ParseDiceRng *rng,
+                                             ParseDiceExpression e) {
+    ParseDiceExpression postfix = parsedice_expression_to_postfix(e);
+
+    ParserItem result = parsedice_expression_evaluate_postfix_rng(rng, postfix);
+
+    parsedice_expression_destroy(&postfix);
+
+    return result;
+}
+
+
+ParserItem parsedice_expression_evaluate_postfix(ParseDiceExpression e) {
+  return parsedice_expression_evaluate_postfix_rng(parsedice_rng_default(), e);
+}
+
+static ParserConstNum dice_sample_with(ParseDiceAliasCache *c,
+                                       ParseDiceRng *rng, Dice d,
+                                       bool approximate);
+
+// Dice are sampled through cache when it isn't NULL, exactly: never from
+// the normal approximation, so the result has the distribution of a roll.
+static ParserItem expression_evaluate_postfix_with(ParserItemStack **s,
+                                                   ParseDiceRng *rng,
+                                                   ParseDiceAliasCache *cache,
+                                                   ParseDiceExpression e) {
+  PARSEDICE_STAGE_BEGIN(Evaluate);
+
+  ParserItem result = out_of_memory_error();
+  bool pushed = *s != NULL;
+
+  if (!pushed)
+    goto end;
+
+  (*s)->length = 0;
+
+  for (size_t i = 0; i < e.length && pushed; ++i) {
+    ParserItem token = e.items[i];
+
+    // Including the out of memory error of a failed conversion to postfix.
+    if (token.type == ParserErrorType) {
+      result = token;
+      goto end;
+    }
+
+    switch (token.type) {
+    case ParserConstNumType:
+      pushed = parser_item_stack_push(s, token);
+      break;
+    case ParserDiceType:
+      pushed = parser_item_stack_push(
+          s, (ParserItem){.type = ParserConstNumType,
+                          .number = cache == NULL
+                                        ? parsedice_dice_roll_rng(
+                                              rng, token.dice, NULL)
+                                        : dice_sample_with(cache, rng,
+                                                           token.dice, false)});
+      break;
+    case ParserOperationType:
+      pushed =
+          parser_item_stack_push(s, handle_operation(e, i, *s, token.operation));
+      break;
+    }
+  }
+
+  // assert(s->length == 1);
+
+  if (pushed)
+    result = parser_item_stack_pop(*s);
+
+end:
+  PARSEDICE_STAGE_END(Evaluate);
+
+  return result;
+}
+
+ParserItem parsedice_expression_evaluate_postfix_rng(ParseDiceRng *rng,
+                                                     ParseDiceExpression e) {
+  ParserItemStack *s = parser_item_stack_create();
+
+  ParserItem res = expression_evaluate_postfix_with(&s, rng, NULL, e);
+
+  parser_item_stack_destroy(s);
+
+  return res;
+}
+
+static const char *const status_str[] = {
+    [ParseDiceOk] = "Ok",
+    [ParseDiceErrorParse] = "Expression contains parse errors",
+    [ParseDiceErrorUnbalanced] = "Unbalanced parenthesis",
+    [ParseDiceErrorMissingOperand] = "Operation is missing an operand",
+    [ParseDiceErrorMissingOperator] = "Operands are missing an operation",
+    [ParseDiceErrorEmpty] = "Expression is empty",
+    [ParseDiceErrorTooDeep] = "Expression is nested too deeply",
+    [ParseDiceErrorOutOfMemory] = "Out of memory",
+    [ParseDiceErrorTooLarge] = "Distribution has too many outcomes",
+    [ParseDiceErrorMismatch] = "Statistics have different histogram ranges",
+    [ParseDiceErrorIo] = "Could not read the file",
+    [ParseDiceErrorUnsupported] = "Not supported for this dice term",
+};
+
+const char *parsedice_status_to_string(ParseDiceStatus status) {
+  return status_str[status];
+}
+
+ParseDiceStatus parsedice_program_compile(ParseDiceExpression e,
+                                          ParseDiceProgram *out) {
+  for (size_t i = 0; i < e.length; ++i) {
+    if (e.items[i].type == ParserErrorType)
+      return ParseDiceErrorParse;
+  }
+
+  if (!parsedice_expression_is_balanced(e))
+    return ParseDiceErrorUnbalanced;
+
+  ParseDiceExpression postfix = parsedice_expression_to_postfix(e);
+
+  ParseDiceStatus status = parsedice_program_compile_postfix(postfix, out);
+
+  parsedice_expression_destroy(&postfix);
+
+  return status;
+}
+
+static ParseDiceStatus program_compile_postfix(ParseDiceExpression postfix,
+                                               ParseDiceProgram *out) {
+  size_t constants_length = 0;
+  size_t dice_length = 0;
+  size_t depth = 0;
+  size_t max_depth = 0;
+
+  // First pass: validate the stack effect of every item and size the arrays.
+  for (size_t i = 0; i < postfix.length; ++i) {
+    ParserItem item = postfix.items[i];
+
+    switch (item.type) {
+    case ParserConstNumType:
+      constants_length++;
+      depth++;
+      break;
+    case ParserDiceType:
+      dice_length++;
+      depth++;
+      break;
+    case ParserOperationType:
+      if (depth < 2)
+        return ParseDiceErrorMissingOperand;
+      depth--;
+      break;
+    case ParserOpenParenthesisType:
+    case ParserCloseParenthesisType:
+      return ParseDiceErrorUnbalanced;
+    case ParserErrorType:
+      if (item.error.type == ParserErrorOutOfMemory)
+        return ParseDiceErrorOutOfMemory;
+      return ParseDiceErrorParse;
+    case ParserNullType:
+      return ParseDiceErrorParse;
+    }
+
+    if (depth > max_depth)
+      max_depth = depth;
+  }
+
+  if (postfix.length == 0)
+    return ParseDiceErrorEmpty;
+
+  if (depth != 1)
+    return ParseDiceErrorMissingOperator;
+
+  if (max_depth > PARSEDICE_PROGRAM_MAX_STACK_DEPTH)
+    return ParseDiceErrorTooDeep;
+
+  size_t max_rolls = 0;
+
+  for (size_t i = 0; i < postfix.length; ++i)
+    if (postfix.items[i].type == ParserDiceType)
+      max_rolls = postfix.items[i].dice.amount > SIZE_MAX - max_rolls
+                      ? SIZE_MAX
+                      : max_rolls + postfix.items[i].dice.amount;
+
+  size_t constants_offset =
+      align_up(sizeof(ParseDiceInstruction) * postfix.length,
+               _Alignof(ParserConstNum));
+  size_t dice_offset =
+      align_up(constants_offset + sizeof(ParserConstNum) * constants_length,
+               _Alignof(Dice));
+  size_t size = dice_offset + sizeof(Dice) * dice_length;
+
+  unsigned char *block = PARSEDICE_MALLOC(size);
+
+  if (block == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  ParseDiceInstruction *code = (ParseDiceInstruction *)block;
+  ParserConstNum *constants = (ParserConstNum *)(block + constants_offset);
+  Dice *dice = (Dice *)(block + dice_offset);
+
+  constants_length = 0;
+  dice_length = 0;
+
+  for (size_t i = 0; i < postfix.length; ++i) {
+    ParserItem item = postfix.items[i];
+
+    switch (item.type) {
+    case ParserConstNumType:
+      constants[constants_length] = item.number;
+      code[i] = (ParseDiceInstruction){.opcode = ParseDiceOpPushConst,
+                                       .index = constants_length++};
+      break;
+    case ParserDiceType:
+      dice[dice_length] = item.dice;
+      code[i] = (ParseDiceInstruction){.opcode = ParseDiceOpRollDice,
+                                       .index = dice_length++};
+      break;
+    default:
+      code[i] = (ParseDiceInstruction){.opcode = ParseDiceOpOperation,
+                                       .operation = item.operation};
+      break;
+    }
+  }
+
+  *out = (ParseDiceProgram){
+      .code = code,
+      .length = postfix.length,
+      .constants = constants,
+      .constants_length = constants_length,
+      .dice = dice,
+      .dice_length = dice_length,
+      .max_stack_depth = max_depth,
+      .max_rolls = max_rolls,
+  };
+
+  return ParseDiceOk;
+}
+
+ParseDiceStatus parsedice_program_compile_postfix(ParseDiceExpression postfix,
+                                                  ParseDiceProgram *out) {
+  PARSEDICE_STAGE_BEGIN(Compile);
+
+  ParseDiceStatus status = program_compile_postfix(postfix, out);
+
+  PARSEDICE_STAGE_END(Compile);
+
+  return status;
+}
+
+// Compiles source text in one pass. When error is not NULL and the text
+// has a syntax error, the error and its position are stored there.
+ParseDiceStatus parsedice_program_compile_slice(StringSlice source,
+                                                ParseDiceProgram *out,
+                                                ParserError *error) {
+  ParseDiceExpression postfix = parse_slice_postfix_in(NULL, source);
+
+  ParseDiceStatus status;
+
+  if (postfix.length > 0 &&
+      postfix.items[postfix.length - 1].type == ParserErrorType) {
+    if (error != NULL)
+      *error = postfix.items[postfix.length - 1].error;
+
+    status = ParseDiceErrorParse;
+  } else {
+    status = parsedice_program_compile_postfix(postfix, out);
+  }
+
+  parsedice_expression_destroy(&postfix);
+
+  return status;
+}
+
+ParseDiceStatus parsedice_program_compile_string(const char *string,
+                                                 ParseDiceProgram *out) {
+  return parsedice_program_compile_slice(string_slice_from_c_str(string), out,
+                                         NULL);
+}
+
+void parsedice_program_destroy(ParseDiceProgram *p) {
+  // code is the start of the single block holding every array.
+  PARSEDICE_FREE((void *)p->code);
+
+  *p = (ParseDiceProgram){0};
+}
+
+ParserConstNum parsedice_program_evaluate(const ParseDiceProgram *p,
+                                          ParseDiceRng *rng) {
+  PARSEDICE_STAGE_BEGIN(Evaluate);
+
+  ParserConstNum stack[PARSEDICE_PROGRAM_MAX_STACK_DEPTH];
+  size_t top = 0;
+
+  for (size_t i = 0; i < p->length; ++i) {
+    ParseDiceInstruction ins = p->code[i];
+
+    switch (ins.opcode) {
+    case ParseDiceOpPushConst:
+      stack[top++] = p->constants[ins.index];
+      break;
+    case ParseDiceOpRollDice:
+      stack[top++] = parsedice_dice_roll_rng(rng, p->dice[ins.index], NULL);
+      break;
+    case ParseDiceOpOperation:
+      top--;
+      stack[top - 1] = op_handlers[ins.operation](stack[top - 1], stack[top]);
+      break;
+    }
+  }
+
+  PARSEDICE_STAGE_END(Evaluate);
+
+  return stack[0];
+}
+
+ParseDiceStatus parsedice_program_evaluate_logged(const ParseDiceProgram *p,
+                                                  ParseDiceRng *rng,
+                                                  ParseDiceRollLog *log,
+                                                  ParserConstNum *result) {
+  log->rolls_length = 0;
+  log->spans_length = 0;
+
+  if (log->rolls_capacity < p->max_rolls ||
+      log->spans_capacity < p->dice_length)
+    return ParseDiceErrorTooLarge;
+
+  PARSEDICE_STAGE_BEGIN(Evaluate);
+
+  ParserConstNum stack[PARSEDICE_PROGRAM_MAX_STACK_DEPTH];
+  size_t top = 0;
+
+  for (size_t i = 0; i < p->length; ++i) {
+    ParseDiceInstruction ins = p->code[i];
+
+    switch (ins.opcode) {
+    case ParseDiceOpPushConst:
+      stack[top++] = p->constants[ins.index];
+      break;
+    case ParseDiceOpRollDice: {
+      Dice d = p->dice[ins.index];
+      ParseDiceRollSpan *span = &log->spans[log->spans_length++];
+
+      *span = (ParseDiceRollSpan){
+          .dice = d,
+          .offset = log->rolls_length,
+          .length = dice_rolls_nothing(d) ? 0 : d.amount,
+          .sum = parsedice_dice_roll_rng(rng, d,
+                                         &log->rolls[log->rolls_length]),
+      };
+
+      log->rolls_length += span->length;
+      stack[top++] = span->sum;
+    } break;
+    case ParseDiceOpOperation:
+      top--;
+      stack[top - 1] = op_handlers[ins.operation](stack[top - 1], stack[top]);
+      break;
+    }
+  }
+
+  PARSEDICE_STAGE_END(Evaluate);
+
+  *result = stack[0];
+
+  return ParseDiceOk;
+}
+
+void parsedice_program_evaluate_batch(const ParseDiceProgram *p,
+                                      ParseDiceRng *rng,
+                                      ParserConstNum results[], size_t n) {
+  PARSEDICE_STAGE_BEGIN(Evaluate);
+
+  ParserConstNum stack[PARSEDICE_PROGRAM_MAX_STACK_DEPTH]
+                      [PARSEDICE_BATCH_BLOCK_SIZE];
+
+  for (size_t start = 0; start < n; start += PARSEDICE_BATCH_BLOCK_SIZE) {
+    size_t block = n - start;
+    if (block > PARSEDICE_BATCH_BLOCK_SIZE)
+      block = PARSEDICE_BATCH_BLOCK_SIZE;
+
+    size_t top = 0;
+
+    for (size_t i = 0; i < p->length; ++i) {
+      ParseDiceInstruction ins = p->code[i];
+
+      switch (ins.opcode) {
+      case ParseDiceOpPushConst: {
+        ParserConstNum c = p->constants[ins.index];
+
+        for (size_t t = 0; t < block; t++)
+          stack[top][t] = c;
+
+        top++;
+      } break;
+      case ParseDiceOpRollDice: {
+        Dice d = p->dice[ins.index];
+
+        for (size_t t = 0; t < block; t++)
+          stack[top][t] = parsedice_dice_roll_rng(rng, d, NULL);
+
+        top++;
+      } break;
+      case ParseDiceOpOperation:
+        top--;
+        op_block_handlers[ins.operation](stack[top - 1], stack[top], block);
+        break;
+      }
+    }
+
+    memcpy(&results[start], stack[0], block * sizeof(ParserConstNum));
+  }
+
+  PARSEDICE_STAGE_END(Evaluate);
+}
+
+ParseDiceStatus parsedice_expression_evaluate_batch(ParseDiceRng *rng,
+                                                    ParseDiceExpression e,
+                                                    ParserConstNum results[],
+                                                    size_t n) {
+  ParseDiceProgram p;
+
+  ParseDiceStatus status = parsedice_program_compile(e, &p);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  parsedice_program_evaluate_batch(&p, rng, results, n);
+  parsedice_program_destroy(&p);
+
+  return ParseDiceOk;
+}
+
+// Distributions are computed on the side as Pmf: sorted, unique values with
+// their probabilities, both as doubles, in one allocation owned by values.
+typedef struct {
+  double *values;
+  double *probs;
+  size_t length;
+} Pmf;
+
+static bool pmf_alloc(Pmf *p, size_t length) {
+  double *block = PARSEDICE_MALLOC(sizeof(double) * (2 * length + 1));
+
+  if (block == NULL)
+    return false;
+
+  *p = (Pmf){.values = block, .probs = block + length, .length = length};
+
+  return true;
+}
+
+static void pmf_free(Pmf *p) {
+  PARSEDICE_FREE(p->values);
+  *p = (Pmf){0};
+}
+
+#define PARSEDICE_PI 3.14159265358979323846
+
+// In-place iterative radix-2 FFT, n must be a power of two.
+static void fft(double *re, double *im, size_t n, bool inverse) {
+  for (size_t i = 1, j = 0; i < n; i++) {
+    size_t bit = n >> 1;
+
+    for (; j & bit; bit >>= 1)
+      j ^= bit;
+    j ^= bit;
+
+    if (i < j) {
+      double t = re[i];
+      re[i] = re[j];
+      re[j] = t;
+
+      t = im[i];
+      im[i] = im[j];
+      im[j] = t;
+    }
+  }
+
+  for (size_t len = 2; len <= n; len <<= 1) {
+    double angle = (inverse ? 2 : -2) * PARSEDICE_PI / len;
+
+    // Twiddles are computed directly instead of by recurrence, which keeps
+    // the error from growing with len.
+    for (size_t k = 0; k < len / 2; k++) {
+      double wr = cos(angle * k);
+      double wi = sin(angle * k);
+
+      for (size_t i = k; i < n; i += len) {
+        size_t v = i + len / 2;
+
+        double tr = re[v] * wr - im[v] * wi;
+        double ti = re[v] * wi + im[v] * wr;
+
+        re[v] = re[i] - tr;
+        im[v] = im[i] - ti;
+        re[i] += tr;
+        im[i] += ti;
+      }
+    }
+  }
+
+  if (inverse) {
+    for (size_t i = 0; i < n; i++) {
+      re[i] /= n;
+      im[i] /= n;
+    }
+  }
+}
+
+static void convolve_direct(const double *a, size_t na, const double *b,
+                            size_t nb, double *out) {
+  memset(out, 0, sizeof(double) * (na + nb - 1));
+
+  for (size_t i = 0; i < na; i++) {
+    for (size_t j = 0; j < nb; j++)
+      out[i + j] += a[i] * b[j];
+  }
+}
+
+// FFT results carry an absolute error around 1e-16 per entry, anything
+// below this is rounding noise and is reported as impossible.
+#define PARSEDICE_FFT_NOISE 1e-15
+
+static bool convolve_fft(const double *a, size_t na, const double *b,
+                         size_t nb, double *out) {
+  size_t n_out = na + nb - 1;
+  size_t n = 1;
+  while (n < n_out)
+    n <<= 1;
+
+  double *block = PARSEDICE_CALLOC(4 * n, sizeof(double));
+
+  if (block == NULL)
+    return false;
+
+  double *are = block, *aim = block + n, *bre = block + 2 * n,
+         *bim = block + 3 * n;
+
+  memcpy(are, a, sizeof(double) * na);
+  memcpy(bre, b, sizeof(double) * nb);
+
+  fft(are, aim, n, false);
+  fft(bre, bim, n, false);
+
+  for (size_t i = 0; i < n; i++) {
+    double re = are[i] * bre[i] - aim[i] * bim[i];
+    double im = are[i] * bim[i] + aim[i] * bre[i];
+
+    are[i] = re;
+    aim[i] = im;
+  }
+
+  fft(are, aim, n, true);
+
+  for (size_t i = 0; i < n_out; i++)
+    out[i] = are[i] < PARSEDICE_FFT_NOISE ? 0 : are[i];
+
+  PARSEDICE_FREE(block);
+
+  return true;
+}
+
+static bool convolve(const double *a, size_t na, const double *b, size_t nb,
+                     double *out) {
+  if (na < PARSEDICE_DISTRIBUTION_FFT_THRESHOLD ||
+      nb < PARSEDICE_DISTRIBUTION_FFT_THRESHOLD) {
+    convolve_direct(a, na, b, nb, out);
+    return true;
+  }
+
+  return convolve_fft(a, na, b, nb, out);
+}
+
+// Dense distribution of the sum of `amount` independent draws from the
+// dense distribution `base`, by repeated squaring.
+static ParseDiceStatus dense_power(const double *base, size_t n_base,
+                                   DiceInt amount, double **out,
+                                   size_t *n_out) {
+  if ((double)(n_base - 1) * amount + 1 > PARSEDICE_DISTRIBUTION_MAX_SUPPORT)
+    return ParseDiceErrorTooLarge;
+
+  size_t n_result = 1;
+  double *result = PARSEDICE_MALLOC(sizeof(double));
+  double *square = PARSEDICE_MALLOC(sizeof(double) * n_base);
+
+  if (result == NULL || square == NULL)
+    goto oom;
+
+  result[0] = 1;
+  memcpy(square, base, sizeof(double) * n_base);
+
+  while (amount > 0) {
+    if (amount & 1) {
+      double *next = PARSEDICE_MALLOC(sizeof(double) * (n_result + n_base - 1));
+
+      if (next == NULL || !convolve(result, n_result, square, n_base, next)) {
+        PARSEDICE_FREE(next);
+        goto oom;
+      }
+
+      PARSEDICE_FREE(result);
+      result = next;
+      n_result += n_base - 1;
+    }
+
+    amount >>= 1;
+
+    if (amount > 0) {
+      double *next = PARSEDICE_MALLOC(sizeof(double) * (2 * n_base - 1));
+
+      if (next == NULL || !convolve(square, n_base, square, n_base, next)) {
+        PARSEDICE_FREE(next);
+        goto oom;
+      }
+
+      PARSEDICE_FREE(square);
+      square = next;
+      n_base = 2 * n_base - 1;
+    }
+  }
+
+  PARSEDICE_FREE(square);
+
+  *out = result;
+  *n_out = n_result;
+
+  return ParseDiceOk;
+
+oom:
+  PARSEDICE_FREE(result);
+  PARSEDICE_FREE(square);
+  return ParseDiceErrorOutOfMemory;
+}
+
+// Converts a dense distribution whose first entry is the value `offset`.
+static bool pmf_from_dense(const double *probs, size_t n, double offset,
+                           Pmf *out) {
+  size_t length = 0;
+  for (size_t i = 0; i < n; i++)
+    length += probs[i] > 0;
+
+  if (!pmf_alloc(out, length))
+    return false;
+
+  length = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (probs[i] > 0) {
+      out->values[length] = offset + (double)i;
+      out->probs[length] = probs[i];
+      length++;
+    }
+  }
+
+  return true;
+}
+
+// Dense distribution of a single die of d, ignoring amount and keep, whose
+// first entry is the value dice_die_min(d). An exploding die that shows
+// the top face L times lands on L * faces plus a face below the top, or
+// any face once L reaches the cap. Explosions less likely than
+// PARSEDICE_FFT_NOISE are left out, like FFT noise.
+static ParseDiceStatus dense_single_die(Dice d, double **out, size_t *n_out) {
+  size_t n = d.faces - d.reroll;
+  double p = 1.0 / n;
+
+  size_t levels = 0;
+  double reach = 1;
+
+  while (d.explode && levels < PARSEDICE_EXPLODE_CAP &&
+         reach * p >= PARSEDICE_FFT_NOISE) {
+    reach *= p;
+    levels++;
+  }
+
+  if ((double)levels * d.faces + n > PARSEDICE_DISTRIBUTION_MAX_SUPPORT)
+    return ParseDiceErrorTooLarge;
+
+  size_t length = levels * d.faces + n;
+  double *die = PARSEDICE_CALLOC(length, sizeof(double));
+
+  if (die == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  double chance = p;
+
+  for (size_t level = 0; level <= levels; level++) {
+    bool last = !d.explode || level == PARSEDICE_EXPLODE_CAP;
+
+    for (size_t i = 0; i < (last ? n : n - 1); i++)
+      die[level * d.faces + i] = chance;
+
+    chance *= p;
+  }
+
+  *out = die;
+  *n_out = length;
+
+  return ParseDiceOk;
+}
+
+// The distribution of a single die of d, ignoring amount and keep.
+static ParseDiceStatus pmf_single_die(Dice d, Pmf *out) {
+  double *die;
+  size_t n_die;
+
+  ParseDiceStatus status = dense_single_die(d, &die, &n_die);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  if (!pmf_from_dense(die, n_die, (double)dice_die_min(d), out))
+    status = ParseDiceErrorOutOfMemory;
+
+  PARSEDICE_FREE(die);
+
+  return status;
+}
+
+// The sum of the kept dice of d, for any single-die distribution with
+// whole-number values. Faces are visited best first; the state is how many
+// dice showed a better face and the sum of those that were kept. How many
+// dice show each face follows a binomial conditioned on them not showing a
+// better one, so states that have filled every kept slot are final.
+static ParseDiceStatus pmf_keep(Dice d, const Pmf *die, Pmf *out) {
+  size_t n = d.amount, k = d.keep_count, m = die->length;
+  bool highest = d.keep == DiceKeepHighest;
+
+  double lowest = die->values[0];
+  size_t span = (size_t)(die->values[m - 1] - lowest);
+
+  if ((double)span * k + 1 > PARSEDICE_DISTRIBUTION_MAX_SUPPORT)
+    return ParseDiceErrorTooLarge;
+
+  size_t n_sums = span * k + 1;
+
+  if ((double)m * (k + 1) * (n + 1) * n_sums > PARSEDICE_DISTRIBUTION_MAX_WORK)
+    return ParseDiceErrorTooLarge;
+
+  // The states before and after a face, for 0..k-1 dice seen, then the
+  // final sums, then log(i!) for 0..n.
+  double *block = PARSEDICE_CALLOC(2 * k * n_sums + n_sums + n + 1,
+                                   sizeof(double));
+
+  if (block == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  double *state = block, *next = block + k * n_sums;
+  double *final = next + k * n_sums;
+  double *log_factorial = final + n_sums;
+
+  for (size_t i = 1; i <= n; i++)
+    log_factorial[i] = log_factorial[i - 1] + log((double)i);
+
+  state[0] = 1;
+  double remaining = 1;
+
+  for (size_t j = 0; j < m; j++) {
+    size_t face = highest ? m - 1 - j : j;
+    size_t offset = (size_t)(die->values[face] - lowest);
+
+    // The chance of this face given that the die didn't show a better one.
+    double q = j + 1 == m ? 1 : die->probs[face] / remaining;
+    if (q > 1)
+      q = 1;
+
+    remaining -= die->probs[face];
+
+    memset(next, 0, sizeof(double) * k * n_sums);
+
+    for (size_t t = 0; t < k; t++) {
+      size_t left = n - t;
+
+      for (size_t c = 0; c <= left; c++) {
+        double w;
+
+        if (q == 1)
+          w = c == left;
+        else if (q == 0)
+          w = c == 0;
+        else
+          w = exp(log_factorial[left] - log_factorial[c] -
+                  log_factorial[left - c] + c * log(q) +
+                  (left - c) * log1p(-q));
+
+        if (w == 0)
+          continue;
+
+        size_t taken = t + c < k ? c : k - t;
+        double *to = t + c < k ? next + (t + c) * n_sums : final;
+        const double *from = state + t * n_sums;
+
+        for (size_t s = 0; s + taken * offset < n_sums; s++)
+          to[s + taken * offset] += from[s] * w;
+      }
+    }
+
+    double *swap = state;
+    state = next;
+    next = swap;
+  }
+
+  bool built = pmf_from_dense(final, n_sums, lowest * k, out);
+  PARSEDICE_FREE(block);
+
+  return built ? ParseDiceOk : ParseDiceErrorOutOfMemory;
+}
+
+// The number of successes of a success-counting term.
+static ParseDiceStatus pmf_binomial(Dice d, Pmf *out) {
+  if ((double)d.amount + 1 > PARSEDICE_DISTRIBUTION_MAX_SUPPORT)
+    return ParseDiceErrorTooLarge;
+
+  size_t n = d.amount;
+  double p = dice_success_chance(d);
+  double *probs = PARSEDICE_MALLOC(sizeof(double) * (n + 1));
+
+  if (probs == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  for (size_t k = 0; k <= n; k++) {
+    if (p == 0 || p == 1) {
+      probs[k] = k == (p == 0 ? 0 : n);
+      continue;
+    }
+
+    probs[k] = exp(lgamma(n + 1.0) - lgamma(k + 1.0) - lgamma(n - k + 1.0) +
+                   k * log(p) + (n - k) * log1p(-p));
+  }
+
+  bool built = pmf_from_dense(probs, n + 1, 0, out);
+  PARSEDICE_FREE(probs);
+
+  return built ? ParseDiceOk : ParseDiceErrorOutOfMemory;
+}
+
+static ParseDiceStatus pmf_dice(Dice d, Pmf *out) {
+  d = dice_normalize_keep(d);
+
+  if (dice_rolls_nothing(d) || d.amount == 0 ||
+      (d.keep != DiceKeepAll && d.keep_count == 0)) {
+    if (!pmf_alloc(out, 1))
+      return ParseDiceErrorOutOfMemory;
+
+    out->values[0] = 0;
+    out->probs[0] = 1;
+    return ParseDiceOk;
+  }
+
+  if (d.count != DiceCountNone)
+    return pmf_binomial(d, out);
+
+  if (d.keep != DiceKeepAll) {
+    Pmf die;
+    ParseDiceStatus status = pmf_single_die(d, &die);
+
+    if (status != ParseDiceOk)
+      return status;
+
+    status = pmf_keep(d, &die, out);
+    pmf_free(&die);
+
+    return status;
+  }
+
+  double *die;
+  size_t n_die;
+
+  ParseDiceStatus status = dense_single_die(d, &die, &n_die);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  double *sum;
+  size_t n_sum;
+
+  status = dense_power(die, n_die, d.amount, &sum, &n_sum);
+  PARSEDICE_FREE(die);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  // The smallest possible sum is the smallest face on every die.
+  if (!pmf_from_dense(sum, n_sum, (double)d.amount * dice_die_min(d), out))
+    status = ParseDiceErrorOutOfMemory;
+
+  PARSEDICE_FREE(sum);
+
+  return status;
+}
+
+// Values that are whole numbers can be combined by convolution.
+static bool pmf_is_lattice(const Pmf *p) {
+  for (size_t i = 0; i < p->length; i++) {
+    if (p->values[i] != floor(p->values[i]) || fabs(p->values[i]) > 1e15)
+      return false;
+  }
+
+  return true;
+}
+
+static ParseDiceStatus pmf_add_lattice(bool subtract, const Pmf *a,
+                                       const Pmf *b, Pmf *out) {
+  size_t na = (size_t)(a->values[a->length - 1] - a->values[0]) + 1;
+  size_t nb = (size_t)(b->values[b->length - 1] - b->values[0]) + 1;
+
+  double *block = PARSEDICE_CALLOC(na + nb + (na + nb - 1), sizeof(double));
+
+  if (block == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  double *da = block, *db = block + na, *sum = block + na + nb;
+
+  for (size_t i = 0; i < a->length; i++)
+    da[(size_t)(a->values[i] - a->values[0])] = a->probs[i];
+
+  // Subtracting is adding the mirrored distribution of b.
+  for (size_t i = 0; i < b->length; i++) {
+    size_t at = subtract ? (size_t)(b->values[b->length - 1] - b->values[i])
+                         : (size_t)(b->values[i] - b->values[0]);
+    db[at] = b->probs[i];
+  }
+
+  double offset = subtract ? a->values[0] - b->values[b->length - 1]
+                           : a->values[0] + b->values[0];
+
+  ParseDiceStatus status = ParseDiceOk;
+
+  if (!convolve(da, na, db, nb, sum) ||
+      !pmf_from_dense(sum, na + nb - 1, offset, out))
+    status = ParseDiceErrorOutOfMemory;
+
+  PARSEDICE_FREE(block);
+
+  return status;
+}
+
+typedef struct {
+  double value;
+  double prob;
+} PmfEntry;
+
+// NaN, which 0 / 0 produces, sorts last and compares equal to itself.
+static int pmf_entry_compare(const void *a, const void *b) {
+  double x = ((const PmfEntry *)a)->value;
+  double y = ((const PmfEntry *)b)->value;
+
+  if (isnan(x) || isnan(y))
+    return isnan(x) - isnan(y);
+
+  return (x > y) - (x < y);
+}
+
+static ParseDiceStatus pmf_combine_pairwise(ParserOperation op, const Pmf *a,
+                                            const Pmf *b, Pmf *out) {
+  if ((double)a->length * b->length > PARSEDICE_DISTRIBUTION_MAX_SUPPORT)
+    return ParseDiceErrorTooLarge;
+
+  size_t n = a->length * b->length;
+  PmfEntry *entries = PARSEDICE_MALLOC(sizeof(PmfEntry) * n);
+
+  if (entries == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  for (size_t i = 0; i < a->length; i++) {
+    for (size_t j = 0; j < b->length; j++) {
+      entries[i * b->length + j] = (PmfEntry){
+          .value = op_handlers[op]((ParserConstNum)a->values[i],
+                                   (ParserConstNum)b->values[j]),
+          .prob = a->probs[i] * b->probs[j],
+      };
+    }
+  }
+
+  qsort(entries, n, sizeof(PmfEntry), pmf_entry_compare);
+
+  size_t length = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (length == 0 ||
+        pmf_entry_compare(&entries[length - 1], &entries[i]) != 0)
+      entries[length++] = entries[i];
+    else
+      entries[length - 1].prob += entries[i].prob;
+  }
+
+  if (!pmf_alloc(out, length)) {
+    PARSEDICE_FREE(entries);
+    return ParseDiceErrorOutOfMemory;
+  }
+
+  for (size_t i = 0; i < length; i++) {
+    out->values[i] = entries[i].value;
+    out->probs[i] = entries[i].prob;
+  }
+
+  PARSEDICE_FREE(entries);
+
+  return ParseDiceOk;
+}
+
+static ParseDiceStatus pmf_combine(ParserOperation op, const Pmf *a,
+                                   const Pmf *b, Pmf *out) {
+  if ((op == ParserOperationAdd || op == ParserOperationSub) &&
+      pmf_is_lattice(a) && pmf_is_lattice(b)) {
+    double range = (a->values[a->length - 1] - a->values[0]) +
+                   (b->values[b->length - 1] - b->values[0]) + 1;
+
+    // Sparse supports spread over a wide range are cheaper pairwise.
+    if (range <= PARSEDICE_DISTRIBUTION_MAX_SUPPORT &&
+        range <= 4.0 * a->length * b->length + 64)
+      return pmf_add_lattice(op == ParserOperationSub, a, b, out);
+  }
+
+  return pmf_combine_pairwise(op, a, b, out);
+}
+
+static ParseDiceStatus pmf_to_distribution(const Pmf *pmf,
+                                           ParseDiceDistribution *out) {
+  size_t values_offset =
+      align_up(sizeof(double) * pmf->length, _Alignof(ParserConstNum));
+  unsigned char *block =
+      PARSEDICE_MALLOC(values_offset + sizeof(ParserConstNum) * pmf->length);
+
+  if (block == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  *out = (ParseDiceDistribution){
+      .probabilities = (double *)block,
+      .values = (ParserConstNum *)(block + values_offset),
+      .length = pmf->length,
+  };
+
+  for (size_t i = 0; i < pmf->length; i++) {
+    out->values[i] = (ParserConstNum)pmf->values[i];
+    out->probabilities[i] = pmf->probs[i];
+  }
+
+  return ParseDiceOk;
+}
+
+ParseDiceStatus parsedice_dice_distribution(Dice d,
+                                            ParseDiceDistribution *out) {
+  Pmf pmf;
+
+  ParseDiceStatus status = pmf_dice(d, &pmf);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  status = pmf_to_distribution(&pmf, out);
+  pmf_free(&pmf);
+
+  return status;
+}
+
+ParseDiceStatus parsedice_program_distribution(const ParseDiceProgram *p,
+                                               ParseDiceDistribution *out) {
+  Pmf stack[PARSEDICE_PROGRAM_MAX_STACK_DEPTH];
+  size_t top = 0;
+
+  ParseDiceStatus status = ParseDiceOk;
+
+  for (size_t i = 0; i < p->length && status == ParseDiceOk; ++i) {
+    ParseDiceInstruction ins = p->code[i];
+
+    switch (ins.opcode) {
+    case ParseDiceOpPushConst:
+      if (!pmf_alloc(&stack[top], 1)) {
+        status = ParseDiceErrorOutOfMemory;
+        break;
+      }
+
+      stack[top].values[0] = p->constants[ins.index];
+      stack[top].probs[0] = 1;
+      top++;
+      break;
+    case ParseDiceOpRollDice:
+      status = pmf_dice(p->dice[ins.index], &stack[top]);
+
+      if (status == ParseDiceOk)
+        top++;
+      break;
+    case ParseDiceOpOperation: {
+      Pmf result;
+
+      status =
+          pmf_combine(ins.operation, &stack[top - 2], &stack[top - 1], &result);
+
+      if (status != ParseDiceOk)
+        break;
+
+      pmf_free(&stack[top - 1]);
+      pmf_free(&stack[top - 2]);
+      stack[top - 2] = result;
+      top--;
+    } break;
+    }
+  }
+
+  // A compiled program always leaves exactly one value on the stack.
+  if (status == ParseDiceOk && top == 1)
+    status = pmf_to_distribution(&stack[0], out);
+
+  while (top > 0)
+    pmf_free(&stack[--top]);
+
+  return status;
+}
+
+void parsedice_distribution_destroy(ParseDiceDistribution *d) {
+  // probabilities is the start of the block that also holds values.
+  PARSEDICE_FREE(d->probabilities);
+
+  *d = (ParseDiceDistribution){0};
+}
+
+// Builds the alias table of a distribution with Vose's method.
+// https://www.keithschwarz.com/darts-dice-coins/
+static bool alias_table_build(const Pmf *pmf, ParseDiceAliasTable *t) {
+  size_t n = pmf->length;
+
+  size_t values_offset =
+      align_up(sizeof(double) * n, _Alignof(ParserConstNum));
+  size_t alias_offset =
+      align_up(values_offset + sizeof(ParserConstNum) * n, _Alignof(uint32_t));
+  unsigned char *block = PARSEDICE_MALLOC(alias_offset + sizeof(uint32_t) * n);
+  uint32_t *work = PARSEDICE_MALLOC(sizeof(uint32_t) * n);
+
+  if (block == NULL || work == NULL) {
+    PARSEDICE_FREE(block);
+    PARSEDICE_FREE(work);
+    return false;
+  }
+
+  double *prob = (double *)block;
+  ParserConstNum *values = (ParserConstNum *)(block + values_offset);
+  uint32_t *alias = (uint32_t *)(block + alias_offset);
+
+  // Small entries are stacked from the front of work, large from the back.
+  size_t n_small = 0, n_large = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    values[i] = (ParserConstNum)pmf->values[i];
+    prob[i] = pmf->probs[i] * n;
+    alias[i] = (uint32_t)i;
+
+    if (prob[i] < 1)
+      work[n_small++] = (uint32_t)i;
+    else
+      work[n - ++n_large] = (uint32_t)i;
+  }
+
+  while (n_small > 0 && n_large > 0) {
+    uint32_t small = work[--n_small];
+    uint32_t large = work[n - n_large];
+
+    alias[small] = large;
+    prob[large] -= 1 - prob[small];
+
+    if (prob[large] < 1) {
+      n_large--;
+      work[n_small++] = large;
+    }
+  }
+
+  // Whatever is left only differs from 1 by rounding.
+  while (n_large > 0)
+    prob[work[n - n_large--]] = 1;
+  while (n_small > 0)
+    prob[work[--n_small]] = 1;
+
+  PARSEDICE_FREE(work);
+
+  t->probabilities = prob;
+  t->values = values;
+  t->alias = alias;
+  t->length = n;
+
+  return true;
+}
+
+static ParserConstNum alias_table_sample(const ParseDiceAliasTable *t,
+                                         ParseDiceRng *rng) {
+  uint32_t i = parsedice_rng_bounded(rng, (uint32_t)t->length);
+  double coin = (parsedice_rng_next(rng) >> 11) * 0x1.0p-53;
+
+  return t->values[coin < t->probabilities[i] ? i : t->alias[i]];
+}
+
+// Pools whose sums don't fit an alias table are sampled from the normal
+// distribution with the pool's mean and variance, rounded to the nearest
+// sum and clamped to the possible range. The sum of N uniform dice is
+// symmetric, so the first correction term of the central limit theorem
+// vanishes and the error in each probability is O(1/N) of the largest
+// one. That says nothing about N, so only pools of at least
+// PARSEDICE_NORMAL_MIN_AMOUNT dice come here; a few dice with many faces
+// have tails nothing like a normal's and are rolled directly.
+static ParserConstNum dice_sample_normal(ParseDiceRng *rng, Dice d) {
+  double n = d.amount, f = d.faces;
+  double mean = n * (f + 1) / 2;
+  double sd = sqrt(n * (f * f - 1) / 12);
+
+  // Box-Muller transform.
+  double z = sqrt(-2 * log(rng_uniform_open(rng))) *
+             cos(2 * PARSEDICE_PI * rng_uniform_open(rng));
+
+  double sum = floor(mean + sd * z + 0.5);
+
+  if (sum < n)
+    sum = n;
+  if (sum > n * f)
+    sum = n * f;
+
+  return (ParserConstNum)sum;
+}
+
+void parsedice_alias_cache_init(ParseDiceAliasCache *c) {
+  *c = (ParseDiceAliasCache){0};
+}
+
+void parsedice_alias_cache_destroy(ParseDiceAliasCache *c) {
+  for (size_t i = 0; i < c->length; i++)
+    PARSEDICE_FREE(c->tables[i].probabilities);
+
+  *c = (ParseDiceAliasCache){0};
+}
+
+static bool dice_equal(Dice a, Dice b) {
+  return a.amount == b.amount && a.faces == b.faces && a.keep == b.keep &&
+         a.keep_count == b.keep_count && a.explode == b.explode &&
+         a.reroll == b.reroll && a.count == b.count && a.target == b.target;
+}
+
+// Plain NdF, whose sum is the sum of independent uniform dice.
+static bool dice_is_plain(Dice d) {
+  return d.keep == DiceKeepAll && !d.explode && d.reroll == 0 &&
+         d.count == DiceCountNone;
+}
+
+// Returns the table for d, building it and evicting the least recently
+// used table when needed. Returns NULL if it can't be built.
+static ParseDiceAliasTable *alias_cache_lookup(ParseDiceAliasCache *c, Dice d) {
+  c->clock++;
+
+  size_t slot = 0;
+
+  for (size_t i = 0; i < c->length; i++) {
+    if (dice_equal(c->tables[i].dice, d)) {
+      c->tables[i].last_used = c->clock;
+      return &c->tables[i];
+    }
+
+    if (c->tables[i].last_used < c->tables[slot].last_used)
+      slot = i;
+  }
+
+  Pmf pmf;
+
+  if (pmf_dice(d, &pmf) != ParseDiceOk)
+    return NULL;
+
+  ParseDiceAliasTable table = {.dice = d, .last_used = c->clock};
+  bool built = alias_table_build(&pmf, &table);
+
+  pmf_free(&pmf);
+
+  if (!built)
+    return NULL;
+
+  if (c->length < PARSEDICE_ALIAS_CACHE_SIZE)
+    slot = c->length++;
+  else
+    PARSEDICE_FREE(c->tables[slot].probabilities);
+
+  c->tables[slot] = table;
+
+  return &c->tables[slot];
+}
+
+// Samples the sum of a dice pool from its alias table, or from the normal
+// approximation when approximate is set and the pool qualifies. Everything
+// else is rolled directly.
+static ParserConstNum dice_sample_with(ParseDiceAliasCache *c,
+                                       ParseDiceRng *rng, Dice d,
+                                       bool approximate) {
+  d = dice_normalize_keep(d);
+
+  // Success counts are already a single binomial draw.
+  if (d.amount < PARSEDICE_ALIAS_MIN_AMOUNT || d.faces <= 1 ||
+      d.count != DiceCountNone || dice_rolls_nothing(d))
+    return parsedice_dice_roll_rng(rng, d, NULL);
+
+  DiceInt counted = d.keep == DiceKeepAll ? d.amount : d.keep_count;
+  double spread = (double)(dice_die_max(d) - dice_die_min(d));
+
+  if (spread * counted + 1 > PARSEDICE_ALIAS_MAX_SUPPORT) {
+    if (!approximate || !dice_is_plain(d) ||
+        d.amount < PARSEDICE_NORMAL_MIN_AMOUNT)
+      return parsedice_dice_roll_rng(rng, d, NULL);
+
+    PARSEDICE_COUNT(dice_rolled, d.amount);
+    return dice_sample_normal(rng, d);
+  }
+
+  ParseDiceAliasTable *t = alias_cache_lookup(c, d);
+
+  if (t == NULL)
+    return parsedice_dice_roll_rng(rng, d, NULL);
+
+  PARSEDICE_COUNT(dice_rolled, d.amount);
+  return alias_table_sample(t, rng);
+}
+
+// Samples the sum of a dice pool in constant time. Small pools are rolled
+// directly.
+ParserConstNum parsedice_dice_sample(ParseDiceAliasCache *c, ParseDiceRng *rng,
+                                     Dice d) {
+  return dice_sample_with(c, rng, d, true);
+}
+
+void parsedice_context_init(ParseDiceContext *ctx, uint64_t seed) {
+  *ctx = (ParseDiceContext){
+      .scratch = parser_item_stack_create(),
+  };
+
+  parsedice_rng_seed(&ctx->rng, seed);
+  parsedice_alias_cache_init(&ctx->alias_cache);
+}
+
+void parsedice_context_destroy(ParseDiceContext *ctx) {
+  arena_destroy(&ctx->arena);
+  parser_item_stack_destroy(ctx->scratch);
+  parsedice_alias_cache_destroy(&ctx->alias_cache);
+
+  ctx->scratch = NULL;
+}
+
+// Releases every expression created by the context. The generator and the
+// alias tables are kept.
+void parsedice_context_reset(ParseDiceContext *ctx) {
+  arena_reset(&ctx->arena);
+}
+
+ParseDiceExpression parsedice_context_parse(ParseDiceContext *ctx,
+                                            const char *string) {
+  return parse_slice_in(&ctx->arena, string_slice_from_c_str(string));
+}
+
+ParseDiceExpression parsedice_context_parse_slice(ParseDiceContext *ctx,
+                                                  StringSlice slice) {
+  return parse_slice_in(&ctx->arena, slice);
+}
+
+ParseDiceExpression parsedice_context_parse_slice_postfix(ParseDiceContext *ctx,
+                                                          StringSlice slice) {
+  return parse_slice_postfix_in(&ctx->arena, slice);
+}
+
+ParseDiceExpression parsedice_context_to_postfix(ParseDiceContext *ctx,
+                                                 ParseDiceExpression e) {
+  return expression_to_postfix_with(&ctx->scratch, &ctx->arena, e);
+}
+
+ParserItem parsedice_context_evaluate(ParseDiceContext *ctx,
+                                      ParseDiceExpression e) {
+  ParseDiceExpression postfix = parsedice_context_to_postfix(ctx, e);
+
+  return expression_evaluate_postfix_with(&ctx->scratch, &ctx->rng,
+                                          &ctx->alias_cache, postfix);
+}
+
+// The optimizer works on the program as a tree. Nodes are created in
+// postfix order, so children always come before their parent and a single
+// forward pass sees every subtree already simplified.
+typedef struct {
+  ParserItem item;
+  size_t left;
+  size_t right;
+
+  // Operation of the parent in the original program, or ParserNullType.
+  ParserTypes parent_type;
+  ParserOperation parent_operation;
+
+  // Bound on the absolute value of the subtree, or INFINITY when it may
+  // not be a whole number.
+  double magnitude;
+  // Whether the subtree may be negative, and may be a float -0, which
+  // adding +0 would turn into +0.
+  bool negative;
+  bool negative_zero;
+} OptNode;
+
+typedef struct {
+  OptNode *nodes;
+  size_t length;
+  size_t capacity;
+  // Set when growing the nodes failed; the tree is garbage from then on.
+  bool out_of_memory;
+  ParseDiceOptimizeReport *report;
+} Optimizer;
+
+#ifndef PARSEDICE_NUMBER_INT64
+// Float arithmetic on whole numbers up to this is exact, so it doesn't
+// depend on the order of the operations.
+#ifdef PARSEDICE_NUMBER_DOUBLE
+static const double opt_exact_limit = 0x1p53;
+#else
+static const double opt_exact_limit = 0x1p24;
+#endif
+#endif
+
+static void opt_measure(Optimizer *o, size_t i) {
+  OptNode *n = &o->nodes[i];
+  const OptNode *l, *r;
+
+  switch (n->item.type) {
+  case ParserConstNumType:
+    n->magnitude = n->item.number == floor(n->item.number)
+                       ? fabs((double)n->item.number)
+                       : INFINITY;
+    n->negative = signbit((double)n->item.number);
+    n->negative_zero = n->negative && n->item.number == 0;
+    break;
+  case ParserDiceType:
+    n->magnitude = n->item.dice.count != DiceCountNone
+                       ? (double)n->item.dice.amount
+                       : (double)n->item.dice.amount *
+                             (double)dice_die_max(n->item.dice);
+    n->negative = n->negative_zero = false;
+    break;
+  default:
+    l = &o->nodes[n->left];
+    r = &o->nodes[n->right];
+
+    switch (n->item.operation) {
+    case ParserOperationAdd:
+      n->magnitude = l->magnitude + r->magnitude;
+      n->negative = l->negative || r->negative;
+      n->negative_zero = l->negative_zero && r->negative_zero;
+      break;
+    case ParserOperationSub:
+      n->magnitude = l->magnitude + r->magnitude;
+      n->negative = true;
+      n->negative_zero = l->negative_zero;
+      break;
+    default:
+      n->magnitude = n->item.operation == ParserOperationMul
+                         ? l->magnitude * r->magnitude
+                         : INFINITY;
+      n->negative = n->negative_zero = l->negative || r->negative;
+      break;
+    }
+    break;
+  }
+}
+
+// Rebuilt chains are pushed again at every enclosing chain they get
+// flattened into, so the node count isn't bounded by the program length.
+static size_t opt_push(Optimizer *o, ParserItem item, size_t left,
+                       size_t right) {
+  if (o->length == o->capacity) {
+    OptNode *grown =
+        PARSEDICE_REALLOC(o->nodes, sizeof(OptNode) * o->capacity * 2);
+
+    if (grown == NULL) {
+      o->out_of_memory = true;
+      return 0;
+    }
+
+    o->nodes = grown;
+    o->capacity *= 2;
+  }
+
+  o->nodes[o->length] = (OptNode){.item = item, .left = left, .right = right};
+  opt_measure(o, o->length);
+
+  return o->length++;
+}
+
+static size_t opt_push_operation(Optimizer *o, ParserOperation op, size_t left,
+                                 size_t right) {
+  return opt_push(o, (ParserItem){.type = ParserOperationType, .operation = op},
+                  left, right);
+}
+
+static size_t opt_push_number(Optimizer *o, ParserConstNum number) {
+  return opt_push(o, (ParserItem){.type = ParserConstNumType, .number = number},
+                  0, 0);
+}
+
+static bool opt_is_number(const Optimizer *o, size_t i, ParserConstNum n) {
+  return o->nodes[i].item.type == ParserConstNumType &&
+         o->nodes[i].item.number == n;
+}
+
+static bool opt_is_chain(const OptNode *n, ParserOperation op) {
+  if (n->item.type != ParserOperationType)
+    return false;
+
+  if (op == ParserOperationMul)
+    return n->item.operation == ParserOperationMul;
+
+  return n->item.operation == ParserOperationAdd ||
+         n->item.operation == ParserOperationSub;
+}
+
+static bool opt_is_chain_root(const OptNode *n, ParserOperation op) {
+  if (!opt_is_chain(n, op))
+    return false;
+
+  OptNode parent = {.item = {.type = n->parent_type,
+                             .operation = n->parent_operation}};
+
+  return !opt_is_chain(&parent, op);
+}
+
+typedef struct {
+  size_t node;
+  bool negative;
+} OptTerm;
+
+// Flattens the + - chain (or * chain) rooted at root into terms, merges
+// dice with the same faces and sign, gathers every constant into one and
+// rebuilds the chain as terms followed by the constant. With floats that
+// reorders rounding, so chains are only rebuilt when every value in them is
+// a whole number small enough to be exact.
+static void opt_chain(Optimizer *o, size_t root, ParserOperation op,
+                      OptTerm *terms, OptTerm *work) {
+  bool sum = op != ParserOperationMul;
+  size_t n_terms = 0, n_work = 0;
+
+#ifndef PARSEDICE_NUMBER_INT64
+  if (!(o->nodes[root].magnitude <= opt_exact_limit))
+    return;
+#endif
+
+  work[n_work++] = (OptTerm){.node = root};
+
+  while (n_work > 0) {
+    OptTerm t = work[--n_work];
+    const OptNode *node = &o->nodes[t.node];
+
+    if (!opt_is_chain(node, op)) {
+      terms[n_terms++] = t;
+      continue;
+    }
+
+    // Push right first so terms come out in source order.
+    work[n_work++] = (OptTerm){
+        .node = node->right,
+        .negative = t.negative != (node->item.operation == ParserOperationSub),
+    };
+    work[n_work++] = (OptTerm){.node = node->left, .negative = t.negative};
+  }
+
+#ifndef PARSEDICE_NUMBER_INT64
+  // Products of whole numbers come out the same, -0 included, in any
+  // order. A sum with a -0 term can come out as -0 or +0 depending on it.
+  for (size_t i = 0; i < n_terms && sum; i++)
+    if (o->nodes[terms[i].node].negative_zero)
+      return;
+#endif
+
+  ParserConstNum constant = sum ? 0 : 1;
+  size_t n_constants = 0;
+  size_t kept = 0;
+
+  for (size_t i = 0; i < n_terms; i++) {
+    ParserItem item = o->nodes[terms[i].node].item;
+
+    if (item.type == ParserConstNumType) {
+      if (!sum)
+        constant = handle_mul(constant, item.number);
+      else if (terms[i].negative)
+        constant = handle_sub(constant, item.number);
+      else
+        constant = handle_add(constant, item.number);
+
+      n_constants++;
+      continue;
+    }
+
+    if (sum && item.type == ParserDiceType) {
+      size_t j = 0;
+
+      for (; j < kept; j++) {
+        OptNode *other = &o->nodes[terms[j].node];
+
+        if (other->item.type == ParserDiceType &&
+            dice_is_plain(other->item.dice) && dice_is_plain(item.dice) &&
+            terms[j].negative == terms[i].negative &&
+            other->item.dice.faces == item.dice.faces &&
+            other->item.dice.amount <= (DiceInt)-1 - item.dice.amount)
+          break;
+      }
+
+      if (j < kept) {
+        // Terms are leaves, so each can be changed in place.
+        o->nodes[terms[j].node].item.dice.amount += item.dice.amount;
+        opt_measure(o, terms[j].node);
+        o->report->dice_merged++;
+        continue;
+      }
+    }
+
+    terms[kept++] = terms[i];
+  }
+
+  if (n_constants > 1)
+    o->report->constants_hoisted += n_constants - 1;
+
+  size_t result = (size_t)-1;
+  bool constant_used = false;
+
+  // Positive terms first, so the chain only needs a leading constant when
+  // every term is subtracted.
+  for (int negative = 0; negative <= 1; negative++) {
+    for (size_t i = 0; i < kept; i++) {
+      if (terms[i].negative != negative)
+        continue;
+
+      if (result == (size_t)-1 && negative) {
+        result = opt_push_operation(o, ParserOperationSub,
+                                    opt_push_number(o, constant),
+                                    terms[i].node);
+        constant_used = true;
+      } else if (result == (size_t)-1) {
+        result = terms[i].node;
+      } else {
+        result = opt_push_operation(o, negative ? ParserOperationSub : op,
+                                    result, terms[i].node);
+      }
+    }
+  }
+
+  bool identity = constant == (sum ? 0 : 1);
+
+  if (result == (size_t)-1)
+    result = opt_push_number(o, constant);
+  else if (!constant_used && !identity)
+    result = opt_push_operation(o, op, result, opt_push_number(o, constant));
+  else if (!constant_used && n_constants > 0)
+    o->report->identities_removed++;
+
+  OptNode *r = &o->nodes[root];
+  ParserTypes parent_type = r->parent_type;
+  ParserOperation parent_operation = r->parent_operation;
+
+  *r = o->nodes[result];
+  r->parent_type = parent_type;
+  r->parent_operation = parent_operation;
+}
+
+static void opt_node(Optimizer *o, size_t i, OptTerm *terms, OptTerm *work) {
+  OptNode *n = &o->nodes[i];
+
+  if (n->item.type != ParserOperationType)
+    return;
+
+  ParserOperation op = n->item.operation;
+  size_t l = n->left, r = n->right;
+
+  if (o->nodes[l].item.type == ParserConstNumType &&
+      o->nodes[r].item.type == ParserConstNumType) {
+    n->item = (ParserItem){
+        .type = ParserConstNumType,
+        .number = op_handlers[op](o->nodes[l].item.number,
+                                  o->nodes[r].item.number),
+    };
+    opt_measure(o, i);
+    o->report->constants_folded++;
+    return;
+  }
+
+  // The children may have been simplified since this node was pushed.
+  opt_measure(o, i);
+
+  size_t keep = (size_t)-1;
+
+  if ((op == ParserOperationAdd && opt_is_number(o, l, 0)) ||
+      (op == ParserOperationMul && opt_is_number(o, l, 1)))
+    keep = r;
+  else if (((op == ParserOperationAdd || op == ParserOperationSub) &&
+            opt_is_number(o, r, 0)) ||
+           ((op == ParserOperationMul || op == ParserOperationDiv) &&
+            opt_is_number(o, r, 1)))
+    keep = l;
+
+#ifndef PARSEDICE_NUMBER_INT64
+  // -0 + 0 is +0, so adding zero is only an identity for what can't be -0.
+  if (keep != (size_t)-1 && op != ParserOperationMul &&
+      op != ParserOperationDiv && o->nodes[keep].negative_zero)
+    keep = (size_t)-1;
+#endif
+
+  if (keep != (size_t)-1) {
+    ParserTypes parent_type = n->parent_type;
+    ParserOperation parent_operation = n->parent_operation;
+
+    *n = o->nodes[keep];
+    n->parent_type = parent_type;
+    n->parent_operation = parent_operation;
+
+    o->report->identities_removed++;
+  }
+
+  if (opt_is_chain_root(n, ParserOperationAdd))
+    opt_chain(o, i, ParserOperationAdd, terms, work);
+  else if (opt_is_chain_root(n, ParserOperationMul))
+    opt_chain(o, i, ParserOperationMul, terms, work);
+}
+
+// Writes the tree below root back out in postfix order.
+static void opt_emit(const Optimizer *o, size_t root, OptTerm *work,
+                     ParseDiceExpression *out) {
+  size_t n_work = 0;
+
+  // OptTerm.negative doubles as "children already pushed".
+  work[n_work++] = (OptTerm){.node = root};
+
+  while (n_work > 0) {
+    OptTerm t = work[--n_work];
+    const OptNode *node = &o->nodes[t.node];
+
+    if (node->item.type != ParserOperationType || t.negative) {
+      parsedice_expression_append(out, node->item);
+      continue;
+    }
+
+    work[n_work++] = (OptTerm){.node = t.node, .negative = true};
+    work[n_work++] = (OptTerm){.node = node->right};
+    work[n_work++] = (OptTerm){.node = node->left};
+  }
+}
+
+ParseDiceStatus parsedice_program_optimize(const ParseDiceProgram *p,
+                                           ParseDiceProgram *out,
+                                           ParseDiceOptimizeReport *report) {
+  ParseDiceOptimizeReport ignored;
+
+  if (report == NULL)
+    report = &ignored;
+
+  *report = (ParseDiceOptimizeReport){.instructions_before = p->length};
+
+  // Simplifying never adds leaves beyond one constant per chain, so the
+  // reachable tree, and with it terms and work, stays within this.
+  size_t capacity = 2 * p->length + 2;
+
+  Optimizer o = {
+      .nodes = PARSEDICE_MALLOC(sizeof(OptNode) * capacity),
+      .capacity = capacity,
+      .report = report,
+  };
+  OptTerm *terms = PARSEDICE_MALLOC(sizeof(OptTerm) * capacity);
+  OptTerm *work = PARSEDICE_MALLOC(sizeof(OptTerm) * 2 * capacity);
+  size_t *stack = PARSEDICE_MALLOC(sizeof(size_t) * p->length);
+
+  ParseDiceStatus status = ParseDiceErrorOutOfMemory;
+
+  if (o.nodes == NULL || terms == NULL || work == NULL || stack == NULL)
+    goto end;
+
+  size_t top = 0;
+
+  for (size_t i = 0; i < p->length; i++) {
+    ParseDiceInstruction ins = p->code[i];
+    size_t node;
+
+    switch (ins.opcode) {
+    case ParseDiceOpPushConst:
+      node = opt_push_number(&o, p->constants[ins.index]);
+      break;
+    case ParseDiceOpRollDice:
+      node = opt_push(&o,
+                      (ParserItem){.type = ParserDiceType,
+                                   .dice = p->dice[ins.index]},
+                      0, 0);
+      break;
+    default:
+      top -= 2;
+      node = opt_push_operation(&o, ins.operation, stack[top], stack[top + 1]);
+
+      o.nodes[stack[top]].parent_type = ParserOperationType;
+      o.nodes[stack[top]].parent_operation = ins.operation;
+      o.nodes[stack[top + 1]].parent_type = ParserOperationType;
+      o.nodes[stack[top + 1]].parent_operation = ins.operation;
+      break;
+    }
+
+    o.nodes[node].parent_type = ParserNullType;
+    stack[top++] = node;
+  }
+
+  for (size_t i = 0; i < p->length && !o.out_of_memory; i++)
+    opt_node(&o, i, terms, work);
+
+  if (o.out_of_memory)
+    goto end;
+
+  ParseDiceExpression postfix = parsedice_expression_create();
+
+  opt_emit(&o, p->length - 1, work, &postfix);
+
+  status = parsedice_program_compile_postfix(postfix, out);
+
+  parsedice_expression_destroy(&postfix);
+
+  if (status == ParseDiceOk)
+    report->instructions_after = out->length;
+
+end:
+  PARSEDICE_FREE(o.nodes);
+  PARSEDICE_FREE(terms);
+  PARSEDICE_FREE(work);
+  PARSEDICE_FREE(stack);
+
+  return status;
+}
+
+#ifndef PARSEDICE_NO_THREADS
+typedef struct {
+  // First member, so the program pointer handed out is the entry pointer.
+  ParseDiceProgram program;
+
+  // The cache holds one reference while the entry is cached.
+  atomic_size_t refs;
+  // Set on every hit, cleared by the eviction clock hand.
+  atomic_bool referenced;
+
+  uint64_t hash;
+  // Next slot in the same bucket, plus one. 0 ends the chain.
+  size_t next;
+
+  size_t key_length;
+  char key[];
+} ProgramCacheEntry;
+
+// Evicts with the CLOCK approximation of LRU, which lets a hit mark its
+// entry as recently used without taking the write lock.
+struct ParseDiceProgramCache {
+  pthread_rwlock_t lock;
+
+  ProgramCacheEntry **slots;
+  size_t capacity;
+  size_t length;
+  size_t hand;
+
+  // Slot of the first entry in each bucket, plus one. 0 means empty.
+  size_t *buckets;
+  size_t bucket_mask;
+
+  atomic_uint_fast64_t hits;
+  atomic_uint_fast64_t misses;
+  atomic_uint_fast64_t evictions;
+};
+
+// FNV-1a
+static uint64_t hash_slice(StringSlice s) {
+  uint64_t h = 0xcbf29ce484222325;
+
+  for (size_t i = 0; i < s.length; i++) {
+    h ^= (unsigned char)s.start[i];
+    h *= 0x100000001b3;
+  }
+
+  return h;
+}
+
+ParseDiceProgramCache *parsedice_program_cache_create(size_t capacity) {
+  if (capacity == 0)
+    capacity = 1;
+
+  size_t bucket_count = 1;
+  while (bucket_count < 2 * capacity)
+    bucket_count <<= 1;
+
+  ParseDiceProgramCache *c = PARSEDICE_CALLOC(1, sizeof(ParseDiceProgramCache));
+
+  if (c == NULL)
+    return NULL;
+
+  c->slots = PARSEDICE_CALLOC(capacity, sizeof(ProgramCacheEntry *));
+  c->buckets = PARSEDICE_CALLOC(bucket_count, sizeof(size_t));
+
+  if (c->slots == NULL || c->buckets == NULL ||
+      pthread_rwlock_init(&c->lock, NULL) != 0) {
+    PARSEDICE_FREE(c->slots);
+    PARSEDICE_FREE(c->buckets);
+    PARSEDICE_FREE(c);
+    return NULL;
+  }
+
+  c->capacity = capacity;
+  c->bucket_mask = bucket_count - 1;
+
+  return c;
+}
+
+static void program_cache_entry_unref(ProgramCacheEntry *e) {
+  if (atomic_fetch_sub(&e->refs, 1) == 1) {
+    parsedice_program_destroy(&e->program);
+    PARSEDICE_FREE(e);
+  }
+}
+
+// Programs still held by callers are freed when they are released.
+void parsedice_program_cache_destroy(ParseDiceProgramCache *c) {
+  for (size_t i = 0; i < c->length; i++)
+    program_cache_entry_unref(c->slots[i]);
+
+  pthread_rwlock_destroy(&c->lock);
+  PARSEDICE_FREE(c->slots);
+  PARSEDICE_FREE(c->buckets);
+  PARSEDICE_FREE(c);
+}
+
+// Must be called with the lock held.
+static ProgramCacheEntry *program_cache_find(ParseDiceProgramCache *c,
+                                             StringSlice source,
+                                             uint64_t hash) {
+  for (size_t at = c->buckets[hash & c->bucket_mask]; at != 0;
+       at = c->slots[at - 1]->next) {
+    ProgramCacheEntry *e = c->slots[at - 1];
+
+    if (e->hash == hash && e->key_length == source.length &&
+        memcmp(e->key, source.start, source.length) == 0)
+      return e;
+  }
+
+  return NULL;
+}
+
+// Must be called with the write lock held.
+static void program_cache_unlink(ParseDiceProgramCache *c, size_t slot) {
+  size_t *link = &c->buckets[c->slots[slot]->hash & c->bucket_mask];
+
+  while (*link != slot + 1)
+    link = &c->slots[*link - 1]->next;
+
+  *link = c->slots[slot]->next;
+}
+
+// Must be called with the write lock held. Returns a free slot, evicting
+// the first entry the clock hand finds without its referenced bit.
+static size_t program_cache_claim_slot(ParseDiceProgramCache *c) {
+  if (c->length < c->capacity)
+    return c->length++;
+
+  for (;;) {
+    size_t slot = c->hand;
+    c->hand = (c->hand + 1) % c->capacity;
+
+    ProgramCacheEntry *e = c->slots[slot];
+
+    if (atomic_exchange(&e->referenced, false))
+      continue;
+
+    program_cache_unlink(c, slot);
+    program_cache_entry_unref(e);
+    atomic_fetch_add(&c->evictions, 1);
+
+    return slot;
+  }
+}
+
+// Returns the compiled program for source, compiling and caching it on a
+// miss, or NULL with *status set when it doesn't compile. Every program
+// returned must be given back with parsedice_program_cache_release.
+const ParseDiceProgram *
+parsedice_program_cache_get(ParseDiceProgramCache *c, StringSlice source,
+                            ParseDiceStatus *status) {
+  uint64_t hash = hash_slice(source);
+
+  pthread_rwlock_rdlock(&c->lock);
+
+  ProgramCacheEntry *e = program_cache_find(c, source, hash);
+
+  if (e != NULL) {
+    atomic_fetch_add(&e->refs, 1);
+    atomic_store_explicit(&e->referenced, true, memory_order_relaxed);
+  }
+
+  pthread_rwlock_unlock(&c->lock);
+
+  if (status != NULL)
+    *status = ParseDiceOk;
+
+  if (e != NULL) {
+    atomic_fetch_add_explicit(&c->hits, 1, memory_order_relaxed);
+    return &e->program;
+  }
+
+  atomic_fetch_add_explicit(&c->misses, 1, memory_order_relaxed);
+
+  // Compile outside the lock so other lookups carry on meanwhile.
+  e = PARSEDICE_MALLOC(sizeof(ProgramCacheEntry) + source.length);
+
+  if (e == NULL) {
+    if (status != NULL)
+      *status = ParseDiceErrorOutOfMemory;
+    return NULL;
+  }
+
+  ParseDiceStatus compiled =
+      parsedice_program_compile_slice(source, &e->program, NULL);
+
+  if (compiled != ParseDiceOk) {
+    PARSEDICE_FREE(e);
+
+    if (status != NULL)
+      *status = compiled;
+    return NULL;
+  }
+
+  atomic_init(&e->refs, 2);
+  atomic_init(&e->referenced, false);
+  e->hash = hash;
+  e->key_length = source.length;
+  memcpy(e->key, source.start, source.length);
+
+  pthread_rwlock_wrlock(&c->lock);
+
+  // Another thread may have cached the same text while this one compiled.
+  ProgramCacheEntry *existing = program_cache_find(c, source, hash);
+
+  if (existing != NULL) {
+    atomic_fetch_add(&existing->refs, 1);
+    pthread_rwlock_unlock(&c->lock);
+
+    parsedice_program_destroy(&e->program);
+    PARSEDICE_FREE(e);
+
+    return &existing->program;
+  }
+
+  size_t slot = program_cache_claim_slot(c);
+  size_t *bucket = &c->buckets[hash & c->bucket_mask];
+
+  e->next = *bucket;
+  *bucket = slot + 1;
+  c->slots[slot] = e;
+
+  pthread_rwlock_unlock(&c->lock);
+
+  return &e->program;
+}
+
+void parsedice_program_cache_release(ParseDiceProgramCache *c,
+                                     const ParseDiceProgram *p) {
+  (void)c;
+
+  program_cache_entry_unref((ProgramCacheEntry *)p);
+}
+
+ParseDiceCacheStats parsedice_program_cache_stats(ParseDiceProgramCache *c) {
+  pthread_rwlock_rdlock(&c->lock);
+  size_t length = c->length;
+  pthread_rwlock_unlock(&c->lock);
+
+  return (ParseDiceCacheStats){
+      .hits = atomic_load(&c->hits),
+      .misses = atomic_load(&c->misses),
+      .evictions = atomic_load(&c->evictions),
+      .length = length,
+  };
+}
+#endif
+
+static void moments_add(ParseDiceMoments *m, ParserConstNum x) {
+  double delta = x - m->mean;
+
+  m->n++;
+  m->mean += delta / m->n;
+  m->m2 += delta * (x - m->mean);
+
+  if (x < m->min)
+    m->min = x;
+  if (x > m->max)
+    m->max = x;
+}
+
+// Chan et al. pairwise merge. Not associative in floating point, so
+// callers that need reproducible results merge in a fixed order.
+static void moments_merge(ParseDiceMoments *into,
+                          const ParseDiceMoments *from) {
+  if (from->n == 0)
+    return;
+
+  uint64_t n = into->n + from->n;
+  double delta = from->mean - into->mean;
+
+  into->mean += delta * from->n / n;
+  into->m2 += from->m2 + delta * delta * into->n / n * from->n;
+  into->n = n;
+
+  if (from->min < into->min)
+    into->min = from->min;
+  if (from->max > into->max)
+    into->max = from->max;
+}
+
+#ifdef PARSEDICE_NUMBER_INT64
+static const ParseDiceMoments moments_empty = {.min = INT64_MAX,
+                                               .max = INT64_MIN};
+#else
+static const ParseDiceMoments moments_empty = {.min = INFINITY,
+                                               .max = -INFINITY};
+#endif
+
+void parsedice_stats_init(ParseDiceStats *s, double histogram_low,
+                          double histogram_high) {
+  memset(s, 0, sizeof(ParseDiceStats));
+
+  s->moments = moments_empty;
+  s->histogram_low = histogram_low;
+  s->histogram_high = histogram_high;
+}
+
+static double sketch_gamma(void) {
+  return (1 + PARSEDICE_STATS_SKETCH_ALPHA) /
+         (1 - PARSEDICE_STATS_SKETCH_ALPHA);
+}
+
+// Bin k holds magnitudes in (gamma^(k-1), gamma^k], offset so that
+// magnitude 1 sits in the middle of the array.
+static size_t sketch_bin(double magnitude) {
+  double key = ceil(log(magnitude) / log(sketch_gamma())) +
+               PARSEDICE_STATS_SKETCH_BINS / 2;
+
+  if (key < 0)
+    return 0;
+  if (key > PARSEDICE_STATS_SKETCH_BINS - 1)
+    return PARSEDICE_STATS_SKETCH_BINS - 1;
+
+  return (size_t)key;
+}
+
+static double sketch_bin_value(size_t bin) {
+  double gamma = sketch_gamma();
+  int key = (int)bin - PARSEDICE_STATS_SKETCH_BINS / 2;
+
+  return 2 * pow(gamma, key) / (gamma + 1);
+}
+
+// Everything but the moments, which unlike the counts depend on the
+// order results arrive in.
+static void stats_count(ParseDiceStats *s, ParserConstNum x) {
+  if (!(x >= s->histogram_low))
+    s->underflow++;
+  else if (!(x < s->histogram_high))
+    s->overflow++;
+  else {
+    size_t bucket = (size_t)((x - s->histogram_low) /
+                             (s->histogram_high - s->histogram_low) *
+                             PARSEDICE_STATS_HISTOGRAM_BUCKETS);
+
+    // Rounding can land values just below the top on the end.
+    if (bucket >= PARSEDICE_STATS_HISTOGRAM_BUCKETS)
+      bucket = PARSEDICE_STATS_HISTOGRAM_BUCKETS - 1;
+
+    s->histogram[bucket]++;
+  }
+
+  if (x > 0)
+    s->sketch_positive[sketch_bin(x)]++;
+  else if (x < 0)
+    s->sketch_negative[sketch_bin(-x)]++;
+  else
+    s->sketch_zero++;
+}
+
+static void stats_merge_counts(ParseDiceStats *into,
+                               const ParseDiceStats *from) {
+  for (size_t i = 0; i < PARSEDICE_STATS_HISTOGRAM_BUCKETS; i++)
+    into->histogram[i] += from->histogram[i];
+
+  into->underflow += from->underflow;
+  into->overflow += from->overflow;
+
+  for (size_t i = 0; i < PARSEDICE_STATS_SKETCH_BINS; i++) {
+    into->sketch_positive[i] += from->sketch_positive[i];
+    into->sketch_negative[i] += from->sketch_negative[i];
+  }
+
+  into->sketch_zero += from->sketch_zero;
+}
+
+void parsedice_stats_add(ParseDiceStats *s, ParserConstNum x) {
+  moments_add(&s->moments, x);
+  stats_count(s, x);
+}
+
+void parsedice_stats_add_batch(ParseDiceStats *s, const ParserConstNum *xs,
+                               size_t n) {
+  for (size_t i = 0; i < n; i++)
+    parsedice_stats_add(s, xs[i]);
+}
+
+ParseDiceStatus parsedice_stats_merge(ParseDiceStats *into,
+                                      const ParseDiceStats *from) {
+  if (into->histogram_low != from->histogram_low ||
+      into->histogram_high != from->histogram_high)
+    return ParseDiceErrorMismatch;
+
+  moments_merge(&into->moments, &from->moments);
+  stats_merge_counts(into, from);
+
+  return ParseDiceOk;
 }
 
-ParseDiceExpression parsedice_parse_string(const char *string) {
-  StringSlice p = string_slice_from_c_str(string);
+// Sample variance.
+double parsedice_stats_variance(const ParseDiceStats *s) {
+  return s->moments.n > 1 ? s->moments.m2 / (s->moments.n - 1) : 0;
+}
 
-  ParseDiceExpression e = parsedice_expression_create();
+// Within PARSEDICE_STATS_SKETCH_ALPHA of the true quantile, relative to
+// its magnitude. Returns NAN when no results were added.
+double parsedice_stats_quantile(const ParseDiceStats *s, double q) {
+  if (s->moments.n == 0)
+    return NAN;
 
-  ParserItem item;
+  q = q < 0 ? 0 : q > 1 ? 1 : q;
 
-  do {
-    item = parse_item(&p);
+  uint64_t rank = (uint64_t)(q * (s->moments.n - 1));
+  uint64_t seen = 0;
+  double value = 0;
 
-    if (item.type == ParserErrorType &&
-        item.error.type == ParserErrorDidNotMatchPattern)
-      return e;
+  // From the most negative bin up to the most positive one.
+  for (size_t i = PARSEDICE_STATS_SKETCH_BINS; i-- > 0;) {
+    seen += s->sketch_negative[i];
 
-    parsedice_expression_append(&e, item);
-  } while (p.length > 0 && item.type != ParserErrorType);
+    if (seen > rank) {
+      value = -sketch_bin_value(i);
+      goto found;
+    }
+  }
 
-  return e;
-}
+  seen += s->sketch_zero;
 
-static const char *const error_str[] = {
-    [ParserErrorExpectedInt] = "Expected Int",
-    [ParserErrorDidNotMatchPattern] =
-        "This error should never be logged, internal error",
-    [ParserErrorNoMatches] = "No types have matched, please check your input",
-};
+  if (seen > rank)
+    goto found;
 
-const char *parsedice_parse_error_to_string(ParserError error) {
-  return error_str[error.type];
+  for (size_t i = 0; i < PARSEDICE_STATS_SKETCH_BINS; i++) {
+    seen += s->sketch_positive[i];
+
+    if (seen > rank) {
+      value = sketch_bin_value(i);
+      break;
+    }
+  }
+
+found:
+  if (value < s->moments.min)
+    return s->moments.min;
+  if (value > s->moments.max)
+    return s->moments.max;
+
+  return value;
 }
 
-const char parsedice_operation_to_char(ParserOperation type) {
-  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(op_mappings); i++) {
-    if (type == op_mappings[i].type)
-      return op_mappings[i].character;
+// Resolves a requested thread count, 0 meaning one per online CPU.
+static unsigned worker_count(unsigned threads) {
+#ifdef PARSEDICE_NO_THREADS
+  (void)threads;
+  return 1;
+#else
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 0 ? (unsigned)cpus : 1;
   }
 
-  return '?';
+  return threads;
+#endif
+}
+
+// Calls run on each of the n structs of size bytes at workers, one per
+// thread. The calling thread is the first worker and picks up the work of
+// any worker that failed to start.
+static void run_workers(void *(*run)(void *), void *workers, size_t size,
+                        unsigned n) {
+  char *at = workers;
+
+#ifdef PARSEDICE_NO_THREADS
+  for (unsigned i = 0; i < n; i++)
+    run(at + i * size);
+#else
+  pthread_t *handles = PARSEDICE_MALLOC(n * sizeof(pthread_t));
+  unsigned started = 1;
+
+  if (handles != NULL)
+    for (; started < n; started++)
+      if (pthread_create(&handles[started], NULL, run, at + started * size) !=
+          0)
+        break;
+
+  for (unsigned i = 0; i < n; i++)
+    if (i == 0 || i >= started)
+      run(at + i * size);
+
+  for (unsigned i = 1; i < started; i++)
+    pthread_join(handles[i], NULL);
+
+  PARSEDICE_FREE(handles);
+#endif
 }
 
 typedef struct {
-  size_t length;
-  size_t capacity;
-  ParserItem items[];
-} ParserItemStack;
+  const ParseDiceProgram *program;
+  uint64_t seed;
+  size_t trials;
+  ParseDiceMoments *chunks;
+  size_t chunks_length;
 
-static ParserItemStack *parser_item_stack_create() {
-  ParserItemStack *s =
-      malloc(sizeof(ParserItemStack) +
-             PARSEDICE_DEFAULT_STACK_SIZE * sizeof(ParserItem));
-  s->length = 0;
-  s->capacity = PARSEDICE_DEFAULT_STACK_SIZE;
+  // Order-independent counts, or NULL when only moments are wanted.
+  ParseDiceStats *counts;
 
-  return s;
-}
+  size_t first_chunk;
+  size_t stride;
+} SimulationWorker;
 
-static void parser_item_stack_destroy(ParserItemStack *s) {
-  free(s);
+static void simulate_chunk(const ParseDiceProgram *p, ParseDiceRng *rng,
+                           size_t n, ParseDiceMoments *chunk,
+                           ParseDiceStats *counts) {
+  ParserConstNum results[PARSEDICE_BATCH_BLOCK_SIZE * 16];
 
-  s = NULL;
+  *chunk = moments_empty;
+
+  while (n > 0) {
+    size_t count = n < PARSEDICE_ARRAY_SIZE(results)
+                       ? n
+                       : PARSEDICE_ARRAY_SIZE(results);
+
+    parsedice_program_evaluate_batch(p, rng, results, count);
+
+    for (size_t i = 0; i < count; i++)
+      moments_add(chunk, results[i]);
+
+    if (counts != NULL)
+      for (size_t i = 0; i < count; i++)
+        stats_count(counts, results[i]);
+
+    n -= count;
+  }
 }
 
-static void parser_item_stack_push(ParserItemStack *s, ParserItem i) {
-  if (s == NULL) {
-    printf(
-        "ERROR: Attempt to push to NULL pointer. Possible use after free bug.");
+static void *simulation_worker_run(void *arg) {
+  SimulationWorker *w = arg;
 
-    return;
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, w->seed);
+
+  for (size_t i = 0; i < w->first_chunk; i++)
+    parsedice_rng_jump(&rng);
+
+  for (size_t c = w->first_chunk; c < w->chunks_length; c += w->stride) {
+    size_t start = c * PARSEDICE_SIMULATION_CHUNK_SIZE;
+    size_t n = w->trials - start < PARSEDICE_SIMULATION_CHUNK_SIZE
+                   ? w->trials - start
+                   : PARSEDICE_SIMULATION_CHUNK_SIZE;
+
+    // The jumps below leave the stream untouched, so chunk c always sees
+    // the same numbers.
+    ParseDiceRng chunk_rng = rng;
+    simulate_chunk(w->program, &chunk_rng, n, &w->chunks[c], w->counts);
+
+    for (size_t i = 0; i < w->stride; i++)
+      parsedice_rng_jump(&rng);
   }
 
-  if (s->length + 1 > s->capacity) {
-    s->capacity *= 2;
-    s = realloc(s, sizeof(ParserItemStack) + sizeof(ParserItem) * s->capacity);
+  return NULL;
+}
+
+// Merges the trials into *moments and, if stats is not NULL, their
+// counts into stats.
+static ParseDiceStatus simulate(const ParseDiceProgram *p, uint64_t seed,
+                                size_t trials, unsigned threads,
+                                ParseDiceMoments *moments,
+                                ParseDiceStats *stats) {
+  if (trials == 0)
+    return ParseDiceErrorEmpty;
+
+  size_t chunks_length = (trials + PARSEDICE_SIMULATION_CHUNK_SIZE - 1) /
+                         PARSEDICE_SIMULATION_CHUNK_SIZE;
+
+  threads = worker_count(threads);
+
+  if (threads > chunks_length)
+    threads = (unsigned)chunks_length;
+
+  ParseDiceMoments *chunks = PARSEDICE_MALLOC(chunks_length * sizeof(ParseDiceMoments));
+  SimulationWorker *workers = PARSEDICE_MALLOC(threads * sizeof(SimulationWorker));
+  ParseDiceStats *counts =
+      stats != NULL ? PARSEDICE_MALLOC(threads * sizeof(ParseDiceStats)) : NULL;
+
+  if (chunks == NULL || workers == NULL || (stats != NULL && counts == NULL)) {
+    PARSEDICE_FREE(chunks);
+    PARSEDICE_FREE(workers);
+    PARSEDICE_FREE(counts);
+    return ParseDiceErrorOutOfMemory;
   }
 
-  s->items[s->length] = i;
-  s->length++;
+  for (unsigned i = 0; i < threads; i++) {
+    if (counts != NULL)
+      parsedice_stats_init(&counts[i], stats->histogram_low,
+                           stats->histogram_high);
+
+    workers[i] = (SimulationWorker){
+        .program = p,
+        .seed = seed,
+        .trials = trials,
+        .chunks = chunks,
+        .chunks_length = chunks_length,
+        .counts = counts != NULL ? &counts[i] : NULL,
+        .first_chunk = i,
+        .stride = threads,
+    };
+  }
+
+  run_workers(simulation_worker_run, workers, sizeof(SimulationWorker),
+              threads);
+
+  // Always in chunk order, whichever worker ran each chunk.
+  for (size_t c = 0; c < chunks_length; c++)
+    moments_merge(moments, &chunks[c]);
+
+  // Integer counts, so the order doesn't matter.
+  if (counts != NULL)
+    for (unsigned i = 0; i < threads; i++)
+      stats_merge_counts(stats, &counts[i]);
+
+  PARSEDICE_FREE(chunks);
+  PARSEDICE_FREE(workers);
+  PARSEDICE_FREE(counts);
+
+  return ParseDiceOk;
 }
 
-static ParserItem parser_item_stack_pop(ParserItemStack *s) {
-  if (s->length <= 0)
-    return (ParserItem){.type = ParserNullType};
+ParseDiceStatus parsedice_program_simulate(const ParseDiceProgram *p,
+                                           uint64_t seed, size_t trials,
+                                           unsigned threads,
+                                           ParseDiceSimulation *out) {
+  ParseDiceMoments total = moments_empty;
+  ParseDiceStatus status = simulate(p, seed, trials, threads, &total, NULL);
+
+  if (status != ParseDiceOk)
+    return status;
+
+  *out = (ParseDiceSimulation){
+      .trials = total.n,
+      .mean = total.mean,
+      .variance = total.n > 1 ? total.m2 / (total.n - 1) : 0,
+      .min = total.min,
+      .max = total.max,
+  };
 
-  return s->items[--s->length];
+  return ParseDiceOk;
 }
 
-static ParserItem parser_item_stack_peek(ParserItemStack *s) {
-  if (s->length <= 0)
-    return (ParserItem){.type = ParserNullType};
+ParseDiceStatus parsedice_program_simulate_stats(const ParseDiceProgram *p,
+                                                 uint64_t seed, size_t trials,
+                                                 unsigned threads,
+                                                 ParseDiceStats *stats) {
+  // Collected separately so that the trials merge into stats as one
+  // block, however many results it already holds.
+  ParseDiceMoments total = moments_empty;
+  ParseDiceStatus status = simulate(p, seed, trials, threads, &total, stats);
 
-  return s->items[s->length - 1];
+  if (status == ParseDiceOk)
+    moments_merge(&stats->moments, &total);
+
+  return status;
 }
 
-bool parsedice_expression_is_balanced(ParseDiceExpression ex) {
-  ParserItemStack *s = parser_item_stack_create();
+typedef struct {
+  StringSlice text;
 
-  bool is_balanced = true;
+  ParseDiceProgram *programs;
+  // Relative to the start of text until the chunks are stitched together.
+  size_t *lines;
+  size_t length;
+  size_t capacity;
+  size_t lines_capacity;
 
-  ParserItem item;
-  for (size_t i = 0; i < ex.length; ++i) {
-    item = ex.items[i];
+  ParseDiceLineError *errors;
+  size_t errors_length;
+  size_t errors_capacity;
 
-    if (item.type == ParserOpenParenthesisType) {
-      parser_item_stack_push(s, item);
-    }
+  size_t lines_seen;
+  bool out_of_memory;
+} BulkWorker;
 
-    if (item.type == ParserCloseParenthesisType) {
-      if (parser_item_stack_pop(s).type == ParserNullType) {
-        is_balanced = false;
-        goto end;
-      }
+static bool bulk_worker_reserve(void **items, size_t *capacity, size_t length,
+                                size_t item_size) {
+  if (length < *capacity)
+    return true;
+
+  size_t new_capacity = *capacity == 0 ? 64 : *capacity * 2;
+  void *grown = PARSEDICE_REALLOC(*items, new_capacity * item_size);
+
+  if (grown == NULL)
+    return false;
+
+  *items = grown;
+  *capacity = new_capacity;
+
+  return true;
+}
+
+static bool bulk_worker_add_line(BulkWorker *w, StringSlice line) {
+  if (line.length > 0 && line.start[line.length - 1] == '\r')
+    line.length--;
+
+  ParseDiceProgram p;
+  ParserError error;
+  ParseDiceStatus status = parsedice_program_compile_slice(line, &p, &error);
+
+  // Blank lines.
+  if (status == ParseDiceErrorEmpty)
+    return true;
+
+  if (status == ParseDiceOk) {
+    bool reserved =
+        bulk_worker_reserve((void **)&w->programs, &w->capacity, w->length,
+                            sizeof(ParseDiceProgram)) &&
+        bulk_worker_reserve((void **)&w->lines, &w->lines_capacity,
+                            w->length, sizeof(size_t));
+
+    if (!reserved) {
+      parsedice_program_destroy(&p);
+      return false;
     }
+
+    w->programs[w->length] = p;
+    w->lines[w->length] = w->lines_seen;
+    w->length++;
+
+    return true;
   }
 
-  if (s->length != 0)
-    is_balanced = false;
+  if (!bulk_worker_reserve((void **)&w->errors, &w->errors_capacity,
+                           w->errors_length, sizeof(ParseDiceLineError)))
+    return false;
 
-end:
-  parser_item_stack_destroy(s);
-  return is_balanced;
+  w->errors[w->errors_length++] = (ParseDiceLineError){
+      .line = w->lines_seen,
+      .column = status == ParseDiceErrorParse
+                    ? (size_t)(error.stopped_at.start - line.start)
+                    : 0,
+      .status = status,
+      .error = status == ParseDiceErrorParse ? error.type : 0,
+  };
+
+  return true;
 }
 
-static const uint precedence_table[] = {
-    [ParserOperationAdd] = 1,
-    [ParserOperationSub] = 1,
-    [ParserOperationMul] = 2,
-    [ParserOperationDiv] = 2,
-};
+static void *bulk_worker_run(void *arg) {
+  BulkWorker *w = arg;
 
-// https://compileralchemy.substack.com/p/step-by-step-parsing-of-mathematical
-ParseDiceExpression parsedice_expression_to_postfix(ParseDiceExpression e) {
-  ParserItemStack *operator_stack = parser_item_stack_create();
+  const char *at = w->text.start;
+  const char *end = w->text.start + w->text.length;
 
-  ParseDiceExpression output = parsedice_expression_create();
+  while (at < end) {
+    const char *newline = memchr(at, '\n', end - at);
+    const char *line_end = newline != NULL ? newline : end;
 
-  for (size_t i = 0; i < e.length; i++) {
-    ParserItem token = e.items[i];
+    w->lines_seen++;
 
-    switch (token.type) {
-    case ParserDiceType:
-    case ParserConstNumType:
-      parsedice_expression_append(&output, token);
+    if (!bulk_worker_add_line(
+            w, (StringSlice){.start = at, .length = line_end - at})) {
+      w->out_of_memory = true;
       break;
-    case ParserOperationType:
-      if (operator_stack->length > 0) {
-        ParserItem on_top = parser_item_stack_peek(operator_stack);
+    }
 
-        if (on_top.type == ParserOpenParenthesisType) {
-          parser_item_stack_push(operator_stack, token);
-        } else if (precedence_table[on_top.operation] >=
-                   precedence_table[token.operation]) {
-          parsedice_expression_append(&output,
-                                      parser_item_stack_pop(operator_stack));
+    at = newline != NULL ? newline + 1 : end;
+  }
 
-          parser_item_stack_push(operator_stack, token);
-        } else {
-          parser_item_stack_push(operator_stack, token);
-        }
-      } else {
-        parser_item_stack_push(operator_stack, token);
-      }
-      break;
-    case ParserOpenParenthesisType:
-      parser_item_stack_push(operator_stack, token);
-      break;
-    case ParserCloseParenthesisType:
-      while (operator_stack->length > 0) {
-        ParserItem on_top = parser_item_stack_peek(operator_stack);
+  return NULL;
+}
 
-        if (on_top.type == ParserOpenParenthesisType) {
-          parser_item_stack_pop(operator_stack);
-          break;
-        } else {
-          parsedice_expression_append(&output,
-                                      parser_item_stack_pop(operator_stack));
-        }
-      }
-      break;
-    default:
-      parser_item_stack_push(operator_stack, token);
-      break;
+// Copies the workers' programs and errors into one block in chunk order,
+// rebasing line numbers and packing every program's arrays behind the
+// tables.
+static ParseDiceStatus bulk_workers_pack(BulkWorker *workers, unsigned n,
+                                         ParseDiceProgramTable *out) {
+  size_t length = 0, errors_length = 0;
+  size_t code_length = 0, constants_length = 0, dice_length = 0;
+
+  for (unsigned i = 0; i < n; i++) {
+    length += workers[i].length;
+    errors_length += workers[i].errors_length;
+
+    for (size_t j = 0; j < workers[i].length; j++) {
+      code_length += workers[i].programs[j].length;
+      constants_length += workers[i].programs[j].constants_length;
+      dice_length += workers[i].programs[j].dice_length;
     }
   }
 
-  while (operator_stack->length > 0) {
-    parsedice_expression_append(&output, parser_item_stack_pop(operator_stack));
-  }
+  size_t lines_offset =
+      align_up(length * sizeof(ParseDiceProgram), _Alignof(size_t));
+  size_t errors_offset = align_up(lines_offset + length * sizeof(size_t),
+                                  _Alignof(ParseDiceLineError));
+  size_t code_offset =
+      align_up(errors_offset + errors_length * sizeof(ParseDiceLineError),
+               _Alignof(ParseDiceInstruction));
+  size_t constants_offset =
+      align_up(code_offset + code_length * sizeof(ParseDiceInstruction),
+               _Alignof(ParserConstNum));
+  size_t dice_offset =
+      align_up(constants_offset + constants_length * sizeof(ParserConstNum),
+               _Alignof(Dice));
+  size_t size = dice_offset + dice_length * sizeof(Dice);
+
+  // Keeps the block non-NULL for empty tables, so it can always be freed.
+  char *block = PARSEDICE_MALLOC(size > 0 ? size : 1);
+
+  if (block == NULL)
+    return ParseDiceErrorOutOfMemory;
+
+  *out = (ParseDiceProgramTable){
+      .programs = (ParseDiceProgram *)block,
+      .lines = (size_t *)(block + lines_offset),
+      .length = length,
+      .errors = (ParseDiceLineError *)(block + errors_offset),
+      .errors_length = errors_length,
+  };
 
-  parser_item_stack_destroy(operator_stack);
+  ParseDiceInstruction *code = (ParseDiceInstruction *)(block + code_offset);
+  ParserConstNum *constants = (ParserConstNum *)(block + constants_offset);
+  Dice *dice = (Dice *)(block + dice_offset);
 
-  return output;
-}
+  size_t program = 0, error = 0, first_line = 1;
 
-static ParserConstNum handle_add(ParserConstNum left, ParserConstNum right) {
-  return left + right;
-}
+  for (unsigned i = 0; i < n; i++) {
+    for (size_t j = 0; j < workers[i].length; j++, program++) {
+      ParseDiceProgram p = workers[i].programs[j];
 
-static ParserConstNum handle_sub(ParserConstNum left, ParserConstNum right) {
-  return left - right;
-}
+      memcpy(code, p.code, p.length * sizeof(ParseDiceInstruction));
+      memcpy(constants, p.constants,
+             p.constants_length * sizeof(ParserConstNum));
+      memcpy(dice, p.dice, p.dice_length * sizeof(Dice));
 
-static ParserConstNum handle_mul(ParserConstNum left, ParserConstNum right) {
-  return left * right;
-}
+      out->programs[program] = p;
+      out->programs[program].code = code;
+      out->programs[program].constants = constants;
+      out->programs[program].dice = dice;
+      out->lines[program] = first_line + workers[i].lines[j] - 1;
 
-static ParserConstNum handle_div(ParserConstNum left, ParserConstNum right) {
-  // TODO: Handle divide by zero
-  return left / right;
-}
+      code += p.length;
+      constants += p.constants_length;
+      dice += p.dice_length;
+    }
 
-static const ParserConstNum (*op_handlers[])(ParserConstNum, ParserConstNum) = {
-    [ParserOperationAdd] = handle_add,
-    [ParserOperationSub] = handle_sub,
-    [ParserOperationMul] = handle_mul,
-    [ParserOperationDiv] = handle_div,
-};
+    for (size_t j = 0; j < workers[i].errors_length; j++, error++) {
+      out->errors[error] = workers[i].errors[j];
+      out->errors[error].line += first_line - 1;
+    }
 
-static ParserItem handle_operation(ParseDiceExpression e, size_t idx, ParserItemStack *s, ParserOperation op) {
-  ParserItem right = parser_item_stack_pop(s);
-  ParserItem left = parser_item_stack_pop(s);
+    first_line += workers[i].lines_seen;
+  }
 
-  return (ParserItem){.type = ParserConstNumType,
-                      .number = op_handlers[op](left.number, right.number)};
+  return ParseDiceOk;
 }
 
-ParserItem parsedice_expression_evaluate(ParseDiceExpression e) {
-    ParseDiceExpression postfix = parsedice_expression_to_postfix(e);
+ParseDiceStatus parsedice_program_table_parse(StringSlice text,
+                                              unsigned threads,
+                                              ParseDiceProgramTable *out) {
+  threads = worker_count(threads);
 
-    ParserItem result = parsedice_expression_evaluate_postfix(postfix);
+  BulkWorker *workers = PARSEDICE_CALLOC(threads, sizeof(BulkWorker));
 
-    parsedice_expression_destroy(&postfix);
+  if (workers == NULL)
+    return ParseDiceErrorOutOfMemory;
 
-    return result;
+  // Split at the first line break after each even share of the text.
+  const char *end = text.start + text.length;
+  const char *at = text.start;
+
+  for (unsigned i = 0; i < threads; i++) {
+    const char *chunk_end =
+        i + 1 == threads ? end : text.start + text.length / threads * (i + 1);
+
+    if (chunk_end < at)
+      chunk_end = at;
+
+    if (chunk_end < end && chunk_end > text.start && chunk_end[-1] != '\n') {
+      const char *newline = memchr(chunk_end, '\n', end - chunk_end);
+      chunk_end = newline != NULL ? newline + 1 : end;
+    }
+
+    workers[i].text = (StringSlice){.start = at, .length = chunk_end - at};
+    at = chunk_end;
+  }
+
+  run_workers(bulk_worker_run, workers, sizeof(BulkWorker), threads);
+
+  ParseDiceStatus status = ParseDiceOk;
+
+  for (unsigned i = 0; i < threads; i++)
+    if (workers[i].out_of_memory)
+      status = ParseDiceErrorOutOfMemory;
+
+  if (status == ParseDiceOk)
+    status = bulk_workers_pack(workers, threads, out);
+
+  for (unsigned i = 0; i < threads; i++) {
+    for (size_t j = 0; j < workers[i].length; j++)
+      parsedice_program_destroy(&workers[i].programs[j]);
+
+    PARSEDICE_FREE(workers[i].programs);
+    PARSEDICE_FREE(workers[i].lines);
+    PARSEDICE_FREE(workers[i].errors);
+  }
+
+  PARSEDICE_FREE(workers);
+
+  return status;
 }
 
+ParseDiceStatus parsedice_program_table_load(const char *path,
+                                             unsigned threads,
+                                             ParseDiceProgramTable *out) {
+  int fd = open(path, O_RDONLY);
 
-ParserItem parsedice_expression_evaluate_postfix(ParseDiceExpression e) {
-  ParserItemStack *s = parser_item_stack_create();
+  if (fd < 0)
+    return ParseDiceErrorIo;
 
-  for (size_t i = 0; i < e.length; ++i) {
-    ParserItem token = e.items[i];
+  struct stat st;
 
-    switch (token.type) {
-    case ParserConstNumType:
-      parser_item_stack_push(s, token);
-      break;
-    case ParserDiceType:
-      parser_item_stack_push(
-          s, (ParserItem){.type = ParserConstNumType,
-                          .number = parsedice_dice_roll(token.dice, NULL)});
-      break;
-    case ParserOperationType:
-      parser_item_stack_push(s, handle_operation(e, i, s, token.operation));
-      break;
-    }
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return ParseDiceErrorIo;
   }
 
-  // assert(s->length == 1);
+  // mmap rejects empty mappings.
+  if (st.st_size == 0) {
+    close(fd);
+    return parsedice_program_table_parse((StringSlice){.start = ""}, threads,
+                                         out);
+  }
 
-  ParserItem res = parser_item_stack_pop(s);
-  parser_item_stack_destroy(s);
+  void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
 
-  return res;
+  if (data == MAP_FAILED)
+    return ParseDiceErrorIo;
+
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  // The table doesn't point into the mapping, so it can go right away.
+  ParseDiceStatus status = parsedice_program_table_parse(
+      (StringSlice){.start = data, .length = st.st_size}, threads, out);
+
+  munmap(data, st.st_size);
+
+  return status;
+}
+
+void parsedice_program_table_destroy(ParseDiceProgramTable *t) {
+  PARSEDICE_FREE(t->programs);
+
+  *t = (ParseDiceProgramTable){0};
 }
 
 // TODO: implement better error printing
-void parsedice_expression_print_errors(const char *original_string,
-                                       ParseDiceExpression e) {
+void parsedice_expression_fprint_errors(FILE *stream,
+                                        const char *original_string,
+                                        ParseDiceExpression e) {
   for (size_t i = 0; i < e.length; ++i) {
     ParserItem item = e.items[i];
 
     if (item.type != ParserErrorType)
       continue;
 
-    printf("ERROR (%s): \"%s\"\n", parsedice_parse_error_to_string(item.error),
-           original_string);
-    printf("Stopped at: \"%s\"\n", item.error.stopped_at.start);
+    fprintf(stream, "ERROR (%s): \"%s\"\n",
+            parsedice_parse_error_to_string(item.error), original_string);
+    fprintf(stream, "Stopped at: \"%.*s\"\n",
+            (int)item.error.stopped_at.length, item.error.stopped_at.start);
   }
 }
 
-void parsedice_parser_item_print(ParserItem i) {
+void parsedice_expression_print_errors(const char *original_string,
+                                       ParseDiceExpression e) {
+  parsedice_expression_fprint_errors(stdout, original_string, e);
+}
+
+// Formats i like snprintf: writes at most size bytes including the NUL and
+// returns the length of the whole text.
+int parsedice_parser_item_snprint(char *buffer, size_t size, ParserItem i) {
   switch (i.type) {
   case ParserConstNumType:
-    printf("%.0f", i.number);
-    break;
-  case ParserDiceType:
-    printf("%dd%d", i.dice.amount, i.dice.faces);
-    break;
+    return snprintf(buffer, size, "%" PARSEDICE_NUMBER_FMT, i.number);
+  case ParserDiceType: {
+    char reroll[16] = "", keep[16] = "", count[16] = "";
+
+    if (i.dice.reroll > 0)
+      snprintf(reroll, sizeof(reroll), "r%u", i.dice.reroll);
+
+    if (i.dice.keep != DiceKeepAll)
+      snprintf(keep, sizeof(keep), "k%c%u",
+               i.dice.keep == DiceKeepHighest ? 'h' : 'l', i.dice.keep_count);
+
+    if (i.dice.count != DiceCountNone)
+      snprintf(count, sizeof(count), "%c=%u",
+               i.dice.count == DiceCountAtLeast ? '>' : '<', i.dice.target);
+
+    return snprintf(buffer, size, "%ud%u%s%s%s%s", i.dice.amount,
+                    i.dice.faces, i.dice.explode ? "!" : "", reroll, keep,
+                    count);
+  }
   case ParserOperationType:
-    putchar(parsedice_operation_to_char(i.operation));
-    break;
+    return snprintf(buffer, size, "%c",
+                    parsedice_operation_to_char(i.operation));
   case ParserOpenParenthesisType:
-    printf("(");
-    break;
+    return snprintf(buffer, size, "(");
   case ParserCloseParenthesisType:
-    printf(")");
-    break;
+    return snprintf(buffer, size, ")");
   case ParserErrorType:
-    printf("ERROR");
-    break;
+    return snprintf(buffer, size, "ERROR");
   case ParserNullType:
-    printf("NULL");
-    break;
+    return snprintf(buffer, size, "NULL");
   }
+
+  return 0;
 }
 
-void parsedice_expression_print(ParseDiceExpression e) {
+void parsedice_parser_item_fprint(FILE *stream, ParserItem i) {
+  // Longer than the longest item, a dice term with every modifier.
+  char text[96];
+
+  parsedice_parser_item_snprint(text, sizeof(text), i);
+  fputs(text, stream);
+}
+
+void parsedice_parser_item_print(ParserItem i) {
+  parsedice_parser_item_fprint(stdout, i);
+}
+
+// Formats the items of e separated by spaces, like snprintf.
+int parsedice_expression_snprint(char *buffer, size_t size,
+                                 ParseDiceExpression e) {
+  size_t length = 0;
+
+  for (size_t i = 0; i < e.length; i++) {
+    if (i > 0)
+      length += snprintf(length < size ? buffer + length : NULL,
+                         length < size ? size - length : 0, " ");
+
+    length += parsedice_parser_item_snprint(
+        length < size ? buffer + length : NULL,
+        length < size ? size - length : 0, e.items[i]);
+  }
+
+  if (e.length == 0 && size > 0)
+    buffer[0] = '\0';
+
+  return (int)length;
+}
+
+void parsedice_expression_fprint(FILE *stream, ParseDiceExpression e) {
   for (size_t i = 0; i < e.length; i++) {
-    parsedice_parser_item_print(e.items[i]);
-    printf(" ");
+    parsedice_parser_item_fprint(stream, e.items[i]);
+    fputc(' ', stream);
   }
-  printf("\n");
+  fputc('\n', stream);
+}
+
+void parsedice_expression_print(ParseDiceExpression e) {
+  parsedice_expression_fprint(stdout, e);
 }
 
 #endif
@@ -0,0 +1,503 @@
+#ifndef PARSEDICE_HPP
+#define PARSEDICE_HPP
+
+// C++20 companion to parsedice.h. Dice expressions written as literals are
+// parsed while compiling:
+//
+//   using namespace parsedice::literals;
+//
+//   constexpr auto damage = "2d6 + 3"_dice;
+//   ParserConstNum x = damage(rng);
+//
+// A syntax error fails the build. The grammar, the modifiers and the
+// arithmetic are those of parsedice.h, and the postfix program becomes one
+// unrolled sequence of statements with the stack slots fixed at compile
+// time. Operations between constants are folded, so evaluating costs the
+// dice rolls and the operations that involve them.
+//
+// Rolling calls parsedice_dice_roll_rng, so PARSEDICE_IMPLEMENTATION must
+// be defined in exactly one C file of the program, as usual.
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+
+#include "parsedice.h"
+
+namespace parsedice {
+
+// A string literal as a template argument.
+template <std::size_t N> struct fixed_string {
+  char chars[N] = {};
+
+  constexpr fixed_string(const char (&string)[N]) {
+    for (std::size_t i = 0; i < N; i++)
+      chars[i] = string[i];
+  }
+
+  constexpr std::size_t size() const { return N - 1; }
+};
+
+namespace detail {
+
+enum class kind : unsigned char { number, dice, add, sub, mul, div };
+
+struct instruction {
+  kind type = kind::number;
+  ParserConstNum number = 0;
+  Dice dice = {};
+};
+
+// A postfix program with room for N instructions.
+template <std::size_t N> struct program {
+  instruction code[N] = {};
+  // Stack height before each instruction.
+  std::size_t height[N] = {};
+  std::size_t length = 0;
+  std::size_t depth = 0;
+};
+
+// The handlers of parsedice.h, which parse-time folding must agree with.
+template <kind Op>
+constexpr ParserConstNum apply(ParserConstNum left, ParserConstNum right) {
+#ifdef PARSEDICE_NUMBER_INT64
+  // Computed on unsigned values, so overflow wraps instead of being
+  // undefined.
+  std::uint64_t l = (std::uint64_t)left, r = (std::uint64_t)right;
+
+  if constexpr (Op == kind::add)
+    return (ParserConstNum)(l + r);
+  else if constexpr (Op == kind::sub)
+    return (ParserConstNum)(l - r);
+  else if constexpr (Op == kind::mul)
+    return (ParserConstNum)(l * r);
+  else {
+    if (right == 0)
+      return 0;
+    if (right == -1)
+      return (ParserConstNum)(0 - l);
+
+    ParserConstNum quotient = left / right;
+
+    if (left % right != 0 && (left < 0) != (right < 0))
+      quotient--;
+
+    return quotient;
+  }
+#else
+  if constexpr (Op == kind::add)
+    return left + right;
+  else if constexpr (Op == kind::sub)
+    return left - right;
+  else if constexpr (Op == kind::mul)
+    return left * right;
+  else
+    return left / right;
+#endif
+}
+
+template <kind Op>
+constexpr bool fold(ParserConstNum left, ParserConstNum right,
+                    ParserConstNum *out) {
+#ifndef PARSEDICE_NUMBER_INT64
+  // Infinities and NaNs aren't constant expressions; leave those to run
+  // time, where they come out the same as in C.
+  long double l = left, r = right, exact;
+  long double max = std::numeric_limits<ParserConstNum>::max();
+
+  if constexpr (Op == kind::add)
+    exact = l + r;
+  else if constexpr (Op == kind::sub)
+    exact = l - r;
+  else if constexpr (Op == kind::mul)
+    exact = l * r;
+  else {
+    if (right == 0)
+      return false;
+    exact = l / r;
+  }
+
+  if (!(exact < max && exact > -max))
+    return false;
+#endif
+
+  *out = apply<Op>(left, right);
+  return true;
+}
+
+constexpr double power_of_ten(long exponent) {
+  double result = 1;
+
+  for (long i = 0; i < exponent; i++)
+    result *= 10;
+
+  return result;
+}
+
+constexpr unsigned char prefix_binding_power = 5;
+
+// Parses like the postfix parser of parsedice.h, throwing where it would
+// report an error, which ends constant evaluation and fails the build.
+template <std::size_t N> struct parser {
+  const char *input;
+  std::size_t length;
+  std::size_t at = 0;
+
+  program<N> out = {};
+  std::size_t height = 0;
+  std::size_t depth = 0;
+
+  constexpr bool more() const { return at < length; }
+  constexpr char peek(std::size_t ahead = 0) const {
+    return at + ahead < length ? input[at + ahead] : '\0';
+  }
+
+  static constexpr bool is_digit(char c) { return c >= '0' && c <= '9'; }
+
+  constexpr void skip_whitespace() {
+    while (more() && (peek() == ' ' || peek() == '\t' || peek() == '\r' ||
+                      peek() == '\n'))
+      at++;
+  }
+
+  constexpr std::size_t lex_digits(std::uint64_t &value,
+                                   std::size_t &dropped) {
+    std::size_t n = 0;
+
+    for (; is_digit(peek()); at++, n++) {
+      if (value < UINT64_C(1000000000000000000))
+        value = value * 10 + (std::uint64_t)(peek() - '0');
+      else
+        dropped++;
+    }
+
+    return n;
+  }
+
+  constexpr DiceInt lex_dice_int() {
+    std::uint64_t value = 0;
+    std::size_t dropped = 0;
+
+    if (lex_digits(value, dropped) == 0)
+      throw "Expected Int";
+
+    if (dropped > 0 || value > (DiceInt)-1)
+      throw "Number is too large";
+
+    return (DiceInt)value;
+  }
+
+  constexpr void lex_dice_count(Dice &d) {
+    if (peek() != '>' && peek() != '<')
+      return;
+
+    if (d.explode || d.keep != DiceKeepAll)
+      throw "Success counting can't be combined with ! or keep/drop";
+
+    bool at_least = peek() == '>';
+    bool strict = peek(1) != '=';
+
+    at += strict ? 1 : 2;
+
+    DiceInt target = lex_dice_int();
+
+    d.count = at_least ? DiceCountAtLeast : DiceCountAtMost;
+    d.target = target;
+
+    if (strict && at_least) {
+      if (target == (DiceInt)-1) {
+        d.count = DiceCountAtMost;
+        d.target = 0;
+      } else {
+        d.target = target + 1;
+      }
+    } else if (strict) {
+      d.target = target > 0 ? target - 1 : 0;
+    }
+  }
+
+  constexpr void lex_dice_modifiers(Dice &d) {
+    bool rerolls = false;
+
+    for (;;) {
+      if (peek() == '!' && !d.explode) {
+        at++;
+        d.explode = true;
+      } else if (peek() == 'r' && !rerolls) {
+        at++;
+        d.reroll = lex_dice_int();
+
+        if (d.reroll > 0 && d.reroll >= d.faces)
+          throw "Reroll covers every face";
+
+        rerolls = true;
+      } else {
+        break;
+      }
+    }
+
+    if (peek() != 'k' && peek() != 'd')
+      return lex_dice_count(d);
+
+    if (peek(1) != 'h' && peek(1) != 'l')
+      throw "Expected kh, kl, dh or dl and a count";
+
+    bool keep = peek() == 'k';
+    bool highest = peek(1) == 'h';
+
+    at += 2;
+
+    DiceInt count = lex_dice_int();
+
+    if (!keep) {
+      count = count < d.amount ? d.amount - count : 0;
+      highest = !highest;
+    }
+
+    if (count < d.amount) {
+      d.keep = highest ? DiceKeepHighest : DiceKeepLowest;
+      d.keep_count = count;
+    }
+
+    lex_dice_count(d);
+  }
+
+  // Reads a dice term or a number at the current position.
+  constexpr instruction lex_number() {
+    std::uint64_t mantissa = 0;
+    std::size_t dropped = 0;
+    std::size_t int_digits = lex_digits(mantissa, dropped);
+
+    if (int_digits > 0 && peek() == 'd') {
+      if (dropped > 0 || mantissa > (DiceInt)-1)
+        throw "Number is too large";
+
+      at++;
+
+      Dice d = {};
+      d.amount = (DiceInt)mantissa;
+      d.faces = lex_dice_int();
+      lex_dice_modifiers(d);
+
+      return {.type = kind::dice, .dice = d};
+    }
+
+#ifdef PARSEDICE_NUMBER_INT64
+    if (peek() == '.')
+      throw "Expected Int";
+
+    if (dropped > 0 || mantissa > (std::uint64_t)INT64_MAX)
+      throw "Number is too large";
+
+    return {.type = kind::number, .number = (ParserConstNum)mantissa};
+#else
+    long exponent = (long)dropped;
+
+    if (peek() == '.') {
+      at++;
+
+      std::size_t frac_dropped = 0;
+      std::size_t frac_digits = lex_digits(mantissa, frac_dropped);
+
+      if (int_digits == 0 && frac_digits == 0)
+        throw "No types have matched, please check your input";
+
+      exponent -= (long)(frac_digits - frac_dropped);
+    }
+
+    double value = exponent < 0 ? mantissa / power_of_ten(-exponent)
+                                : mantissa * power_of_ten(exponent);
+
+    return {.type = kind::number, .number = (ParserConstNum)value};
+#endif
+  }
+
+  constexpr void emit(instruction ins) {
+    out.code[out.length] = ins;
+    out.height[out.length] = height;
+    out.length++;
+
+    if (ins.type == kind::number || ins.type == kind::dice)
+      height++;
+    else
+      height--;
+
+    if (height > out.depth)
+      out.depth = height;
+  }
+
+  template <kind Op> constexpr bool fold_last() {
+    if (out.length < 2 || out.code[out.length - 1].type != kind::number ||
+        out.code[out.length - 2].type != kind::number)
+      return false;
+
+    ParserConstNum folded;
+
+    if (!fold<Op>(out.code[out.length - 2].number,
+                  out.code[out.length - 1].number, &folded))
+      return false;
+
+    out.length -= 2;
+    height -= 2;
+    emit({.type = kind::number, .number = folded});
+
+    return true;
+  }
+
+  // Two numbers just before an operation are its operands, since any
+  // larger operand would end with an operation.
+  constexpr void emit_operation(kind op) {
+    bool folded = op == kind::add   ? fold_last<kind::add>()
+                  : op == kind::sub ? fold_last<kind::sub>()
+                  : op == kind::mul ? fold_last<kind::mul>()
+                                    : fold_last<kind::div>();
+
+    if (!folded)
+      emit({.type = op});
+  }
+
+  static constexpr bool is_operation(char c) {
+    return c == '+' || c == '-' || c == '*' || c == '/';
+  }
+
+  static constexpr kind operation(char c) {
+    return c == '+'   ? kind::add
+           : c == '-' ? kind::sub
+           : c == '*' ? kind::mul
+                      : kind::div;
+  }
+
+  static constexpr unsigned char left_power(kind op) {
+    return op == kind::add || op == kind::sub ? 1 : 3;
+  }
+
+  constexpr void parse(unsigned char min_bp) {
+    if (++depth > PARSEDICE_MAX_NESTING)
+      throw "Expression is nested too deeply";
+
+    skip_whitespace();
+
+    char c = peek();
+
+    if (is_digit(c) || c == '.') {
+      emit(lex_number());
+    } else if (c == '(') {
+      at++;
+      parse(0);
+      skip_whitespace();
+
+      if (peek() != ')')
+        throw "Unbalanced parenthesis";
+
+      at++;
+    } else if (c == '+' || c == '-') {
+      at++;
+
+      // -x is emitted as 0 x -, like in parsedice.h.
+      if (c == '-')
+        emit({.type = kind::number, .number = 0});
+
+      parse(prefix_binding_power);
+
+      if (c == '-')
+        emit_operation(kind::sub);
+    } else if (more() && !is_operation(c) && c != ')') {
+      throw "No types have matched, please check your input";
+    } else {
+      throw "Expected a dice, number or parenthesis";
+    }
+
+    for (;;) {
+      skip_whitespace();
+      c = peek();
+
+      if (!more() || c == ')')
+        break;
+
+      if (!is_operation(c)) {
+        if (is_digit(c) || c == '.' || c == '(')
+          throw "Expected an operation";
+        throw "No types have matched, please check your input";
+      }
+
+      kind op = operation(c);
+
+      if (left_power(op) < min_bp)
+        break;
+
+      at++;
+      parse(left_power(op) + 1);
+      emit_operation(op);
+    }
+
+    depth--;
+  }
+};
+
+template <fixed_string S> consteval auto compile() {
+  parser<2 * S.size() + 1> p = {.input = S.chars, .length = S.size()};
+
+  p.skip_whitespace();
+
+  if (!p.more())
+    throw "Expression is empty";
+
+  p.parse(0);
+
+  if (p.more())
+    throw "Unbalanced parenthesis";
+
+  return p.out;
+}
+
+template <auto P, std::size_t I>
+inline void step(ParserConstNum *stack, ParseDiceRng *rng) {
+  constexpr instruction ins = P.code[I];
+  constexpr std::size_t top = P.height[I];
+
+  if constexpr (ins.type == kind::number)
+    stack[top] = ins.number;
+  else if constexpr (ins.type == kind::dice)
+    stack[top] = parsedice_dice_roll_rng(rng, ins.dice, nullptr);
+  else
+    stack[top - 2] = apply<ins.type>(stack[top - 2], stack[top - 1]);
+}
+
+template <auto P> inline ParserConstNum run(ParseDiceRng *rng) {
+  ParserConstNum stack[P.depth];
+
+  [&]<std::size_t... I>(std::index_sequence<I...>) {
+    (step<P, I>(stack, rng), ...);
+  }(std::make_index_sequence<P.length>{});
+
+  return stack[0];
+}
+
+} // namespace detail
+
+// A dice expression parsed at compile time.
+template <fixed_string S> struct expression {
+  static constexpr auto program = detail::compile<S>();
+
+  ParserConstNum operator()(ParseDiceRng &rng) const {
+    return detail::run<program>(&rng);
+  }
+
+  // Rolls with parsedice_rng_default().
+  ParserConstNum operator()() const {
+    return detail::run<program>(parsedice_rng_default());
+  }
+};
+
+namespace literals {
+
+template <fixed_string S> consteval expression<S> operator""_dice() {
+  return {};
+}
+
+} // namespace literals
+
+} // namespace parsedice
+
+#endif
@@ -0,0 +1,123 @@
+#include <assert.h>
+#include <stdio.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static const char source[] = "1d20 + 5\n"
+                             "\n"
+                             "2d6 +\n"
+                             "  (3d6) * 2\r\n"
+                             "   \n"
+                             "4d4 )\n"
+                             "1d8";
+
+static void check_table(const ParseDiceProgramTable *t) {
+  assert(t->length == 3);
+  assert(t->lines[0] == 1 && t->lines[1] == 4 && t->lines[2] == 7);
+
+  assert(t->programs[0].length == 3);
+  assert(t->programs[0].dice[0].faces == 20);
+  assert(t->programs[1].dice[0].amount == 3);
+  assert(t->programs[1].constants[0] == 2);
+  assert(t->programs[2].dice[0].faces == 8);
+
+  ParserConstNum x = parsedice_program_evaluate(&t->programs[1],
+                                                parsedice_rng_default());
+  assert(x >= 6 && x <= 36);
+
+  assert(t->errors_length == 2);
+
+  assert(t->errors[0].line == 3);
+  assert(t->errors[0].status == ParseDiceErrorParse);
+  assert(t->errors[0].error == ParserErrorExpectedOperand);
+  assert(t->errors[0].column == 5);
+
+  assert(t->errors[1].line == 6);
+  assert(t->errors[1].error == ParserErrorUnbalancedParenthesis);
+  assert(t->errors[1].column == 4);
+}
+
+void test_program_table_parse(void) {
+  StringSlice text = {.start = source, .length = strlen(source)};
+
+  // More threads than lines leaves some chunks empty.
+  unsigned thread_counts[] = {1, 2, 3, 16};
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(thread_counts); i++) {
+    ParseDiceProgramTable t;
+    assert(parsedice_program_table_parse(text, thread_counts[i], &t) ==
+           ParseDiceOk);
+
+    check_table(&t);
+    parsedice_program_table_destroy(&t);
+  }
+
+  ParseDiceProgramTable empty;
+  assert(parsedice_program_table_parse((StringSlice){.start = ""}, 4, &empty) ==
+         ParseDiceOk);
+  assert(empty.length == 0 && empty.errors_length == 0);
+  parsedice_program_table_destroy(&empty);
+}
+
+void test_program_table_load(void) {
+  char path[] = "/tmp/parsedice_bulk_XXXXXX";
+  int fd = mkstemp(path);
+  assert(fd >= 0);
+
+  FILE *f = fdopen(fd, "w");
+  fputs(source, f);
+  fclose(f);
+
+  ParseDiceProgramTable t;
+  assert(parsedice_program_table_load(path, 0, &t) == ParseDiceOk);
+  check_table(&t);
+  parsedice_program_table_destroy(&t);
+
+  unlink(path);
+
+  assert(parsedice_program_table_load(path, 0, &t) == ParseDiceErrorIo);
+}
+
+void test_program_table_threads(void) {
+  size_t lines = 20000;
+  char *text = malloc(lines * 16);
+  size_t length = 0;
+
+  for (size_t i = 0; i < lines; i++)
+    length += sprintf(text + length, i % 97 == 0 ? "%zud6 *\n" : "%zud6 + %zu\n",
+                      i % 50 + 1, i % 7);
+
+  StringSlice slice = {.start = text, .length = length};
+
+  ParseDiceProgramTable single, parallel;
+  assert(parsedice_program_table_parse(slice, 1, &single) == ParseDiceOk);
+  assert(parsedice_program_table_parse(slice, 7, &parallel) == ParseDiceOk);
+
+  assert(single.length + single.errors_length == lines);
+  assert(single.errors_length == (lines + 96) / 97);
+
+  assert(single.length == parallel.length);
+  assert(memcmp(single.lines, parallel.lines, single.length * sizeof(size_t)) ==
+         0);
+  assert(memcmp(single.errors, parallel.errors,
+                single.errors_length * sizeof(ParseDiceLineError)) == 0);
+
+  for (size_t i = 0; i < single.length; i++) {
+    assert(single.programs[i].length == parallel.programs[i].length);
+    assert(single.programs[i].dice[0].amount ==
+           parallel.programs[i].dice[0].amount);
+    assert(single.programs[i].dice[0].amount ==
+           (single.lines[i] - 1) % 50 + 1);
+  }
+
+  parsedice_program_table_destroy(&single);
+  parsedice_program_table_destroy(&parallel);
+  free(text);
+}
+
+int main(void) {
+  test_program_table_parse();
+  test_program_table_load();
+  test_program_table_threads();
+}
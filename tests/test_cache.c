@@ -0,0 +1,115 @@
+#include <assert.h>
+#include <pthread.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static StringSlice slice(const char *s) {
+  return (StringSlice){.start = s, .length = strlen(s)};
+}
+
+void test_program_cache(void) {
+  ParseDiceProgramCache *c = parsedice_program_cache_create(4);
+
+  ParseDiceStatus status;
+  const ParseDiceProgram *a =
+      parsedice_program_cache_get(c, slice("1d20 + 5"), &status);
+
+  assert(status == ParseDiceOk);
+  assert(a != NULL);
+  assert(a->length == 3);
+
+  const ParseDiceProgram *b =
+      parsedice_program_cache_get(c, slice("1d20 + 5"), &status);
+
+  assert(a == b);
+
+  ParseDiceCacheStats stats = parsedice_program_cache_stats(c);
+  assert(stats.hits == 1);
+  assert(stats.misses == 1);
+  assert(stats.length == 1);
+
+  parsedice_program_cache_release(c, a);
+  parsedice_program_cache_release(c, b);
+
+  assert(parsedice_program_cache_get(c, slice("1d20 +"), &status) == NULL);
+  assert(status == ParseDiceErrorParse);
+
+  const char *inputs[] = {"1d4", "1d6", "1d8", "1d10", "1d12", "1d20"};
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(inputs); i++)
+    parsedice_program_cache_release(
+        c, parsedice_program_cache_get(c, slice(inputs[i]), NULL));
+
+  stats = parsedice_program_cache_stats(c);
+  assert(stats.length == 4);
+  assert(stats.evictions == 3);
+
+  parsedice_program_cache_destroy(c);
+}
+
+void test_program_cache_outlives_eviction(void) {
+  ParseDiceProgramCache *c = parsedice_program_cache_create(1);
+
+  const ParseDiceProgram *held =
+      parsedice_program_cache_get(c, slice("2d6 + 3"), NULL);
+
+  // Evicts "2d6 + 3" while it is still held.
+  parsedice_program_cache_release(
+      c, parsedice_program_cache_get(c, slice("1d4"), NULL));
+
+  assert(parsedice_program_cache_stats(c).evictions == 1);
+
+  ParserConstNum result = parsedice_program_evaluate(held, parsedice_rng_default());
+  assert(result >= 5 && result <= 15);
+
+  parsedice_program_cache_destroy(c);
+  parsedice_program_cache_release(c, held);
+}
+
+static const char *thread_inputs[] = {
+    "1d20 + 5", "2d6 + 3", "4d6", "1d8 + 1d6", "3d10 * 2", "1d100", "8d4 - 2",
+};
+
+static void *cache_worker(void *arg) {
+  ParseDiceProgramCache *c = arg;
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, (uint64_t)(uintptr_t)&rng);
+
+  for (size_t i = 0; i < 20000; i++) {
+    const char *input = thread_inputs[i % PARSEDICE_ARRAY_SIZE(thread_inputs)];
+    const ParseDiceProgram *p = parsedice_program_cache_get(c, slice(input), NULL);
+
+    assert(p != NULL);
+    assert(parsedice_program_evaluate(p, &rng) > 0);
+
+    parsedice_program_cache_release(c, p);
+  }
+
+  return NULL;
+}
+
+void test_program_cache_threads(void) {
+  // Smaller than the working set, so threads evict each other's entries.
+  ParseDiceProgramCache *c = parsedice_program_cache_create(4);
+
+  pthread_t threads[4];
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(threads); i++)
+    pthread_create(&threads[i], NULL, cache_worker, c);
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(threads); i++)
+    pthread_join(threads[i], NULL);
+
+  ParseDiceCacheStats stats = parsedice_program_cache_stats(c);
+  assert(stats.hits + stats.misses == 4 * 20000);
+  assert(stats.length == 4);
+
+  parsedice_program_cache_destroy(c);
+}
+
+int main(void) {
+  test_program_cache();
+  test_program_cache_outlives_eviction();
+  test_program_cache_threads();
+}
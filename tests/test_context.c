@@ -0,0 +1,129 @@
+#include <assert.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+void test_context_evaluate(void) {
+  ParseDiceContext ctx;
+  parsedice_context_init(&ctx, 1);
+
+  const char *input_str = "(3d6 - 2) * 10";
+
+  ParseDiceExpression e = parsedice_context_parse(&ctx, input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  assert(e.arena == &ctx.arena);
+  assert(e.length == 7);
+
+  ParseDiceExpression postfix = parsedice_context_to_postfix(&ctx, e);
+
+  assert(postfix.length == 5);
+  assert(postfix.items[4].type == ParserOperationType);
+  assert(postfix.items[4].operation == ParserOperationMul);
+
+  ParserItem result = parsedice_context_evaluate(&ctx, e);
+
+  assert(result.type == ParserConstNumType);
+  assert(result.number >= 10 && result.number <= 160);
+
+  parsedice_context_destroy(&ctx);
+}
+
+void test_context_steady_state(void) {
+  ParseDiceContext ctx;
+  parsedice_context_init(&ctx, 2);
+
+  const char *inputs[] = {
+      "1d20 + 5",
+      "((((((((2d6 + 1) * 2) - 1) * 2) + 1) * 2) - 1) * 2)",
+      "10d10 + 10d10 + 10d10 + 10d10 + 10d10 + 10d10 + 10d10 + 10d10",
+  };
+
+  ParseDiceArenaBlock *block = NULL;
+  ParserItemStack *scratch = NULL;
+
+  for (int round = 0; round < 10; round++) {
+    for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(inputs); i++) {
+      ParseDiceExpression e = parsedice_context_parse(&ctx, inputs[i]);
+
+      ParserItem result = parsedice_context_evaluate(&ctx, e);
+
+      assert(result.type == ParserConstNumType);
+    }
+
+    parsedice_context_reset(&ctx);
+
+    // After the first round the arena is a single block big enough for a
+    // whole round and the scratch stack is deep enough, so nothing moves.
+    assert(ctx.arena.block->previous == NULL);
+    assert(ctx.arena.block->used == 0);
+
+    if (round > 1) {
+      assert(ctx.arena.block == block);
+      assert(ctx.scratch == scratch);
+    }
+
+    block = ctx.arena.block;
+    scratch = ctx.scratch;
+  }
+
+  parsedice_context_destroy(&ctx);
+}
+
+// Pools too big for an alias table are rolled, not approximated, so a
+// context evaluates like parsedice_expression_evaluate.
+void test_context_evaluate_exact(void) {
+  ParseDiceContext ctx;
+  parsedice_context_init(&ctx, 3);
+
+  const char *inputs[] = {"8d100000", "2000d100 - 1d6"};
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(inputs); i++) {
+    ParseDiceExpression e = parsedice_context_parse(&ctx, inputs[i]);
+
+    for (int j = 0; j < 100; j++) {
+      ParseDiceRng rng = ctx.rng;
+      ParserItem expected = parsedice_expression_evaluate_rng(&rng, e);
+
+      assert(parsedice_context_evaluate(&ctx, e).number == expected.number);
+    }
+  }
+
+  parsedice_context_destroy(&ctx);
+}
+
+void test_arena_realloc(void) {
+  ParseDiceArena a = {0};
+
+  unsigned char *p = arena_alloc(&a, 16);
+  memset(p, 7, 16);
+
+  // The last allocation grows in place.
+  assert(arena_realloc(&a, p, 16, 64) == p);
+
+  unsigned char *q = arena_alloc(&a, 8);
+  unsigned char *moved = arena_realloc(&a, p, 64, 128);
+
+  assert(moved != p && moved != q);
+  for (int i = 0; i < 16; i++)
+    assert(moved[i] == 7);
+
+  // Larger than a whole block.
+  assert(arena_alloc(&a, PARSEDICE_ARENA_DEFAULT_CAPACITY * 3) != NULL);
+  assert(a.block->previous != NULL);
+
+  arena_reset(&a);
+  assert(a.block->previous == NULL);
+  assert(a.block->capacity >= PARSEDICE_ARENA_DEFAULT_CAPACITY * 4);
+
+  arena_destroy(&a);
+  assert(a.block == NULL);
+}
+
+int main(void) {
+  test_context_evaluate();
+  test_context_steady_state();
+  test_context_evaluate_exact();
+  test_arena_realloc();
+}
@@ -0,0 +1,99 @@
+#include <cassert>
+#include <cmath>
+
+#include "parsedice.hpp"
+
+using namespace parsedice::literals;
+
+// Operations between constants are folded while compiling.
+static_assert(("1 + 2 * 3"_dice).program.length == 1);
+static_assert(("1 + 2 * 3"_dice).program.code[0].number == 7);
+static_assert(("2d6 + 3 * 4"_dice).program.length == 3);
+static_assert(("-(2 - 5)"_dice).program.code[0].number == 3);
+
+// Modifiers are normalized like parsedice.h does.
+static_assert(("10d10dl2"_dice).program.code[0].dice.keep == DiceKeepHighest);
+static_assert(("10d10dl2"_dice).program.code[0].dice.keep_count == 8);
+static_assert(("15d10>7"_dice).program.code[0].dice.target == 8);
+
+// The stack holds what a left-to-right evaluation needs.
+static_assert(("1d4 + 1d6 * 1d8"_dice).program.depth == 3);
+static_assert(("1d4 * 1d6 + 1d8"_dice).program.depth == 2);
+
+// "((...(1)...))" with N parentheses.
+template <std::size_t N> constexpr parsedice::fixed_string<2 * N + 2> nested() {
+  char chars[2 * N + 2] = {};
+
+  for (std::size_t i = 0; i < N; i++) {
+    chars[i] = '(';
+    chars[N + 1 + i] = ')';
+  }
+
+  chars[N] = '1';
+
+  return chars;
+}
+
+// The most parentheses parsedice.h accepts, the outermost expression being
+// one level of its own. One more fails the build.
+constexpr std::size_t deepest = PARSEDICE_MAX_NESTING - 1;
+static_assert(parsedice::expression<nested<deepest>()>::program.length == 1);
+
+// Rolls the literal and the runtime-compiled expression from the same seed.
+template <parsedice::fixed_string S> static void check_same(const char *input) {
+  parsedice::expression<S> literal;
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string(input, &p) == ParseDiceOk);
+
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 25);
+  parsedice_rng_seed(&b, 25);
+
+  for (int i = 0; i < 1000; i++) {
+    ParserConstNum x = literal(a);
+    ParserConstNum y = parsedice_program_evaluate(&p, &b);
+
+    assert(x == y || (std::isnan((double)x) && std::isnan((double)y)));
+  }
+
+  parsedice_program_destroy(&p);
+}
+
+void test_dice_literal_matches_runtime(void) {
+  check_same<"2d6+3">("2d6+3");
+  check_same<"(1d20 + 5) * 2 - 1d4">("(1d20 + 5) * 2 - 1d4");
+  check_same<"4d6kh3 + 4d6dl1">("4d6kh3 + 4d6dl1");
+  check_same<"15d10>=8 * 2 + 20d6<3">("15d10>=8 * 2 + 20d6<3");
+  check_same<"-3 + 2d6!">("-3 + 2d6!");
+  check_same<"10d10dl2 / 3 / 2">("10d10dl2 / 3 / 2");
+  check_same<"1.5 * 2d6r1 - .25">("1.5 * 2d6r1 - .25");
+  check_same<"1d6 / 0 + 1 / 0">("1d6 / 0 + 1 / 0");
+  check_same<" ((1d6)) * -(2 + 1d4) ">(" ((1d6)) * -(2 + 1d4) ");
+}
+
+void test_dice_literal_nesting_limit(void) {
+  ParseDiceProgram p;
+
+  assert(parsedice_program_compile_string(nested<deepest>().chars, &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_compile_string(nested<deepest + 1>().chars, &p) ==
+         ParseDiceErrorParse);
+
+  parsedice_program_destroy(&p);
+}
+
+void test_dice_literal_default_rng(void) {
+  constexpr auto attack = "1d20 + 5"_dice;
+
+  for (int i = 0; i < 1000; i++) {
+    ParserConstNum x = attack();
+    assert(x >= 6 && x <= 25);
+  }
+}
+
+int main(void) {
+  test_dice_literal_matches_runtime();
+  test_dice_literal_nesting_limit();
+  test_dice_literal_default_rng();
+}
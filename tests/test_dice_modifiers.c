@@ -0,0 +1,633 @@
+#include <assert.h>
+#include <math.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static Dice parse_dice(const char *input_str) {
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  assert(e.length == 1);
+  assert(e.items[0].type == ParserDiceType);
+
+  Dice d = e.items[0].dice;
+  parsedice_expression_destroy(&e);
+
+  return d;
+}
+
+static ParserErrorEnum parse_error(const char *input_str) {
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  assert(e.length > 0);
+  assert(e.items[e.length - 1].type == ParserErrorType);
+
+  ParserErrorEnum error = e.items[e.length - 1].error.type;
+  parsedice_expression_destroy(&e);
+
+  return error;
+}
+
+static int compare_desc(const void *a, const void *b) {
+  ParserConstNum x = *(const ParserConstNum *)a, y = *(const ParserConstNum *)b;
+
+  return (x < y) - (x > y);
+}
+
+void test_keep_drop_parsing(void) {
+  struct {
+    const char *input_str;
+    DiceKeep keep;
+    DiceInt keep_count;
+  } cases[] = {
+      {"4d6kh3", DiceKeepHighest, 3},
+      {"2d20kl1", DiceKeepLowest, 1},
+      {"10d10dl2", DiceKeepHighest, 8},
+      {"10d10dh2", DiceKeepLowest, 8},
+      {"4d6dl4", DiceKeepHighest, 0},
+      // Keeping every die is a plain roll.
+      {"4d6kh4", DiceKeepAll, 0},
+      {"4d6kl9", DiceKeepAll, 0},
+      {"4d6dh0", DiceKeepAll, 0},
+  };
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    Dice d = parse_dice(cases[i].input_str);
+
+    assert(d.keep == cases[i].keep);
+    assert(d.keep_count == cases[i].keep_count);
+  }
+
+  assert(parse_error("4d6k3") == ParserErrorExpectedModifier);
+  assert(parse_error("4d6d") == ParserErrorExpectedModifier);
+  assert(parse_error("4d6kh") == ParserErrorExpectedInt);
+  assert(parse_error("4d6khx") == ParserErrorExpectedInt);
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("(4d6kh3 + 2) * 2", &p) ==
+         ParseDiceOk);
+
+  for (int i = 0; i < 100; i++) {
+    ParserConstNum x = parsedice_program_evaluate(&p, parsedice_rng_default());
+    assert(x >= 10 && x <= 40);
+  }
+
+  parsedice_program_destroy(&p);
+}
+
+// Checks the selected sum against sorting the logged dice.
+static void check_keep(ParseDiceRng *rng, Dice d) {
+  ParserConstNum *rolls = malloc(sizeof(ParserConstNum) * d.amount);
+
+  ParserConstNum sum = parsedice_dice_roll_rng(rng, d, rolls);
+
+  qsort(rolls, d.amount, sizeof(ParserConstNum), compare_desc);
+
+  double expected = 0;
+  for (size_t i = 0; i < d.keep_count; i++)
+    expected += d.keep == DiceKeepHighest ? rolls[i]
+                                          : rolls[d.amount - 1 - i];
+
+  // Float sums past 2^24 round, so compare relative to the total.
+  assert(fabs(sum - expected) <= 1e-6 * expected);
+
+  free(rolls);
+}
+
+void test_keep_drop_roll(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 20);
+
+  // Counting by face, and one, two and four narrowing passes.
+  DiceInt faces[] = {2, 6, 20, 256, 1000, 100000, 4000000000u};
+  DiceInt amounts[] = {1, 2, 5, 64, 300, 1000};
+
+  for (size_t f = 0; f < PARSEDICE_ARRAY_SIZE(faces); f++) {
+    for (size_t a = 0; a < PARSEDICE_ARRAY_SIZE(amounts); a++) {
+      DiceInt n = amounts[a];
+      DiceInt counts[] = {0, 1, n / 2, n - 1};
+
+      for (size_t k = 0; k < PARSEDICE_ARRAY_SIZE(counts); k++) {
+        if (counts[k] >= n)
+          continue;
+
+        for (int keep = DiceKeepHighest; keep <= DiceKeepLowest; keep++)
+          check_keep(&rng, (Dice){.amount = n,
+                                  .faces = faces[f],
+                                  .keep = keep,
+                                  .keep_count = counts[k]});
+      }
+    }
+  }
+
+  // The result doesn't depend on whether the dice are logged.
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 3);
+  parsedice_rng_seed(&b, 3);
+
+  Dice d = {.amount = 50, .faces = 100000, .keep = DiceKeepLowest,
+            .keep_count = 7};
+  ParserConstNum rolls[50];
+
+  for (int i = 0; i < 20; i++)
+    assert(parsedice_dice_roll_rng(&a, d, NULL) ==
+           parsedice_dice_roll_rng(&b, d, rolls));
+
+  // Keeping more dice than were rolled, which only a hand-built Dice can
+  // ask for, is a plain roll everywhere.
+  Dice plain = {.amount = 2, .faces = 6};
+  Dice keep_all = {.amount = 2, .faces = 6, .keep = DiceKeepHighest,
+                   .keep_count = 5};
+  uint64_t plain_counts[6], keep_all_counts[6];
+  ParseDiceAliasCache cache;
+  ParseDiceDistribution dist;
+
+  parsedice_alias_cache_init(&cache);
+
+  for (int i = 0; i < 100; i++) {
+    assert(parsedice_dice_roll_rng(&a, keep_all, NULL) ==
+           parsedice_dice_roll_rng(&b, plain, NULL));
+    assert(parsedice_dice_sample(&cache, &a, keep_all) ==
+           parsedice_dice_sample(&cache, &b, plain));
+
+    assert(parsedice_dice_roll_counts(&a, keep_all, keep_all_counts, 6) ==
+           ParseDiceOk);
+    assert(parsedice_dice_roll_counts(&b, plain, plain_counts, 6) ==
+           ParseDiceOk);
+    assert(memcmp(plain_counts, keep_all_counts, sizeof(plain_counts)) == 0);
+  }
+
+  assert(parsedice_dice_distribution(keep_all, &dist) == ParseDiceOk);
+  assert(dist.length == 11 && dist.values[dist.length - 1] == 12);
+  assert(fabs(dist.probabilities[dist.length - 1] - 1.0 / 36) < 1e-12);
+
+  parsedice_distribution_destroy(&dist);
+  parsedice_alias_cache_destroy(&cache);
+}
+
+// Enumerates every roll of d to get its exact distribution.
+static void brute_force_keep(Dice d, double *probs, size_t n_probs) {
+  DiceInt faces[8] = {0};
+  double p = pow(d.faces, -(double)d.amount);
+
+  memset(probs, 0, sizeof(double) * n_probs);
+
+  for (;;) {
+    ParserConstNum sorted[8];
+    for (size_t i = 0; i < d.amount; i++)
+      sorted[i] = faces[i] + 1;
+
+    qsort(sorted, d.amount, sizeof(ParserConstNum), compare_desc);
+
+    size_t sum = 0;
+    for (size_t i = 0; i < d.keep_count; i++)
+      sum += d.keep == DiceKeepHighest ? sorted[i] : sorted[d.amount - 1 - i];
+
+    assert(sum < n_probs);
+    probs[sum] += p;
+
+    size_t i = 0;
+    while (i < d.amount && ++faces[i] == d.faces)
+      faces[i++] = 0;
+
+    if (i == d.amount)
+      break;
+  }
+}
+
+void test_keep_drop_distribution(void) {
+  Dice cases[] = {
+      {.amount = 4, .faces = 6, .keep = DiceKeepHighest, .keep_count = 3},
+      {.amount = 2, .faces = 20, .keep = DiceKeepLowest, .keep_count = 1},
+      {.amount = 5, .faces = 4, .keep = DiceKeepLowest, .keep_count = 3},
+      {.amount = 3, .faces = 10, .keep = DiceKeepHighest, .keep_count = 2},
+      {.amount = 6, .faces = 3, .keep = DiceKeepHighest, .keep_count = 0},
+  };
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    double expected[64];
+    brute_force_keep(cases[i], expected, 64);
+
+    ParseDiceDistribution d;
+    assert(parsedice_dice_distribution(cases[i], &d) == ParseDiceOk);
+
+    double total = 0;
+    for (size_t j = 0; j < d.length; j++) {
+      assert(fabs(d.probabilities[j] - expected[(size_t)d.values[j]]) < 1e-12);
+      total += d.probabilities[j];
+    }
+
+    size_t possible = 0;
+    for (size_t j = 0; j < 64; j++)
+      possible += expected[j] > 0;
+
+    assert(d.length == possible);
+    assert(fabs(total - 1) < 1e-12);
+
+    parsedice_distribution_destroy(&d);
+  }
+
+  // 4d6 drop lowest, the classic ability score.
+  ParseDiceDistribution d;
+  assert(parsedice_dice_distribution(
+             (Dice){.amount = 4, .faces = 6, .keep = DiceKeepHighest,
+                    .keep_count = 3},
+             &d) == ParseDiceOk);
+
+  assert(d.values[d.length - 1] == 18);
+  assert(fabs(d.probabilities[d.length - 1] - 21.0 / 1296) < 1e-12);
+  parsedice_distribution_destroy(&d);
+
+  // Big pools are still cheap.
+  assert(parsedice_dice_distribution(
+             (Dice){.amount = 100, .faces = 20, .keep = DiceKeepHighest,
+                    .keep_count = 10},
+             &d) == ParseDiceOk);
+  assert(d.values[0] == 10 && d.values[d.length - 1] == 200);
+  parsedice_distribution_destroy(&d);
+
+  // Sampling through the alias cache matches the exact mean.
+  ParseDiceAliasCache cache;
+  parsedice_alias_cache_init(&cache);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 4);
+
+  Dice pool = {.amount = 12, .faces = 6, .keep = DiceKeepLowest,
+               .keep_count = 4};
+  assert(parsedice_dice_distribution(pool, &d) == ParseDiceOk);
+
+  double mean = 0;
+  for (size_t j = 0; j < d.length; j++)
+    mean += d.values[j] * d.probabilities[j];
+
+  double sampled = 0;
+  for (int i = 0; i < 100000; i++)
+    sampled += parsedice_dice_sample(&cache, &rng, pool);
+
+  assert(fabs(sampled / 100000 - mean) < 0.02);
+
+  parsedice_distribution_destroy(&d);
+  parsedice_alias_cache_destroy(&cache);
+}
+
+void test_keep_drop_optimize(void) {
+  ParseDiceProgram p, optimized;
+  ParseDiceOptimizeReport report;
+
+  assert(parsedice_program_compile_string("4d6kh3 + 4d6kh3 + 1d6 + 1d6", &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_optimize(&p, &optimized, &report) == ParseDiceOk);
+
+  // Only the plain dice merge.
+  assert(report.dice_merged == 1);
+  assert(optimized.dice_length == 3);
+
+  parsedice_program_destroy(&p);
+  parsedice_program_destroy(&optimized);
+}
+
+void test_explode_reroll_parsing(void) {
+  Dice d = parse_dice("6d6!");
+  assert(d.amount == 6 && d.faces == 6 && d.explode && d.reroll == 0);
+
+  d = parse_dice("4d6r1");
+  assert(!d.explode && d.reroll == 1 && d.keep == DiceKeepAll);
+
+  d = parse_dice("4d6!r2kh3");
+  assert(d.explode && d.reroll == 2 && d.keep == DiceKeepHighest &&
+         d.keep_count == 3);
+
+  d = parse_dice("4d6r2!dl1");
+  assert(d.explode && d.reroll == 2 && d.keep == DiceKeepHighest &&
+         d.keep_count == 3);
+
+  assert(parse_error("4d6r6") == ParserErrorRerollAll);
+  assert(parse_error("4d6r") == ParserErrorExpectedInt);
+  // Keep/drop comes last, and each modifier appears once.
+  assert(parse_error("4d6kh3!") == ParserErrorNoMatches);
+  assert(parse_error("4d6!!") == ParserErrorNoMatches);
+}
+
+void test_explode_reroll_roll(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 21);
+
+  ParserConstNum rolls[1000];
+
+  // Rerolled faces never come up, on the SIMD path or the logged one.
+  Dice reroll = {.amount = 1000, .faces = 6, .reroll = 2};
+  ParserConstNum sum = parsedice_dice_roll_rng(&rng, reroll, rolls);
+  ParserConstNum logged = 0;
+
+  for (size_t i = 0; i < 1000; i++) {
+    assert(rolls[i] >= 3 && rolls[i] <= 6);
+    logged += rolls[i];
+  }
+
+  assert(sum == logged);
+
+  for (int i = 0; i < 100; i++) {
+    ParserConstNum x = parsedice_dice_roll_rng(&rng, reroll, NULL);
+    assert(x >= 3000 && x <= 6000);
+  }
+
+  // An exploding d6 averages 3.5 * 6/5.
+  Dice explode = {.amount = 1000, .faces = 6, .explode = true};
+  double total = 0;
+
+  for (int i = 0; i < 100; i++) {
+    sum = parsedice_dice_roll_rng(&rng, explode, rolls);
+    logged = 0;
+
+    for (size_t j = 0; j < 1000; j++) {
+      // Only the last draw of a die can stop below the top face.
+      assert(rolls[j] >= 1 && fmod(rolls[j], 6) != 0);
+      logged += rolls[j];
+    }
+
+    assert(sum == logged);
+    total += sum;
+  }
+
+  assert(fabs(total / 100000 - 4.2) < 0.05);
+
+  // A die that always explodes stops at the cap.
+  Dice always = {.amount = 3, .faces = 3, .explode = true, .reroll = 2};
+  assert(parsedice_dice_roll_rng(&rng, always, NULL) ==
+         3 * 3 * (PARSEDICE_EXPLODE_CAP + 1));
+
+  // The parser rejects rerolling every face; built by hand, such dice roll
+  // nothing instead of landing outside the die.
+  Dice reroll_all = {.amount = 1000, .faces = 6, .reroll = 6};
+  ParseDiceAliasCache cache;
+  ParseDiceDistribution d;
+
+  parsedice_alias_cache_init(&cache);
+
+  assert(parsedice_dice_roll_rng(&rng, reroll_all, rolls) == 0);
+  assert(parsedice_dice_sample(&cache, &rng, reroll_all) == 0);
+  assert(parsedice_dice_distribution(reroll_all, &d) == ParseDiceOk);
+  assert(d.length == 1 && d.values[0] == 0 && d.probabilities[0] == 1);
+
+  parsedice_distribution_destroy(&d);
+  parsedice_alias_cache_destroy(&cache);
+
+  // Keeping works on exploded and rerolled values.
+  DiceInt faces[] = {2, 6, 100000, 4000000000u};
+
+  for (size_t f = 0; f < PARSEDICE_ARRAY_SIZE(faces); f++) {
+    for (int keep = DiceKeepHighest; keep <= DiceKeepLowest; keep++) {
+      check_keep(&rng, (Dice){.amount = 300, .faces = faces[f], .keep = keep,
+                              .keep_count = 40, .explode = true});
+      check_keep(&rng, (Dice){.amount = 300, .faces = faces[f], .keep = keep,
+                              .keep_count = 40, .reroll = 1});
+    }
+  }
+}
+
+// The chance of each value of a single die, looping over explosions.
+static void single_die(Dice d, double *probs, size_t n_probs) {
+  double p = 1.0 / (d.faces - d.reroll);
+
+  memset(probs, 0, sizeof(double) * n_probs);
+
+  double chance = 1;
+  for (size_t level = 0; chance > 1e-30; level++) {
+    bool last = !d.explode || level == PARSEDICE_EXPLODE_CAP;
+
+    for (size_t face = d.reroll + 1; face <= d.faces; face++) {
+      if (face == d.faces && !last)
+        continue;
+
+      if (level * d.faces + face < n_probs)
+        probs[level * d.faces + face] += chance * p;
+    }
+
+    if (last)
+      break;
+
+    chance *= p;
+  }
+}
+
+// Enumerates two or three dice with the given single-die distribution.
+static void brute_force_dice(Dice d, const double *die, size_t n_die,
+                             double *probs, size_t n_probs) {
+  memset(probs, 0, sizeof(double) * n_probs);
+
+  for (size_t a = 0; a < n_die; a++) {
+    for (size_t b = 0; b < n_die; b++) {
+      for (size_t c = 0; c < (d.amount == 3 ? n_die : 1); c++) {
+        double p = die[a] * die[b] * (d.amount == 3 ? die[c] : 1);
+
+        if (p == 0)
+          continue;
+
+        ParserConstNum sorted[3] = {a, b, c};
+        qsort(sorted, d.amount, sizeof(ParserConstNum), compare_desc);
+
+        size_t k = d.keep == DiceKeepAll ? d.amount : d.keep_count;
+        size_t sum = 0;
+
+        for (size_t i = 0; i < k; i++)
+          sum += d.keep == DiceKeepLowest ? sorted[d.amount - 1 - i]
+                                          : sorted[i];
+
+        if (sum < n_probs)
+          probs[sum] += p;
+      }
+    }
+  }
+}
+
+void test_explode_reroll_distribution(void) {
+  Dice cases[] = {
+      {.amount = 2, .faces = 6, .reroll = 2},
+      {.amount = 2, .faces = 6, .explode = true},
+      {.amount = 3, .faces = 4, .explode = true, .reroll = 1},
+      {.amount = 3, .faces = 4, .explode = true, .keep = DiceKeepHighest,
+       .keep_count = 2},
+      {.amount = 3, .faces = 6, .reroll = 1, .keep = DiceKeepLowest,
+       .keep_count = 1},
+  };
+
+  static double die[200], expected[600];
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    single_die(cases[i], die, 200);
+    brute_force_dice(cases[i], die, 200, expected, 600);
+
+    ParseDiceDistribution d;
+    assert(parsedice_dice_distribution(cases[i], &d) == ParseDiceOk);
+
+    double total = 0;
+    for (size_t j = 0; j < d.length; j++) {
+      assert(fabs(d.probabilities[j] - expected[(size_t)d.values[j]]) < 1e-12);
+      total += d.probabilities[j];
+    }
+
+    assert(fabs(total - 1) < 1e-12);
+
+    parsedice_distribution_destroy(&d);
+  }
+
+  // Sampling through the alias cache matches the exact mean.
+  ParseDiceAliasCache cache;
+  parsedice_alias_cache_init(&cache);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 5);
+
+  Dice pool = {.amount = 10, .faces = 6, .explode = true, .reroll = 1};
+  double sampled = 0;
+
+  for (int i = 0; i < 100000; i++)
+    sampled += parsedice_dice_sample(&cache, &rng, pool);
+
+  // Each die is uniform on 2..6 and explodes on a 6 with chance 1/5.
+  assert(fabs(sampled / 100000 - 10 * 4.0 * 5 / 4) < 0.2);
+
+  parsedice_alias_cache_destroy(&cache);
+
+  ParseDiceProgram p, optimized;
+  ParseDiceOptimizeReport report;
+
+  assert(parsedice_program_compile_string("2d6! + 2d6! + 2d6r1 + 2d6r1", &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_optimize(&p, &optimized, &report) == ParseDiceOk);
+  assert(report.dice_merged == 0);
+
+  parsedice_program_destroy(&p);
+  parsedice_program_destroy(&optimized);
+}
+
+void test_success_count_parsing(void) {
+  Dice d = parse_dice("15d10>=8");
+  assert(d.count == DiceCountAtLeast && d.target == 8);
+
+  d = parse_dice("20d6>4");
+  assert(d.count == DiceCountAtLeast && d.target == 5);
+
+  d = parse_dice("5d10<=2");
+  assert(d.count == DiceCountAtMost && d.target == 2);
+
+  d = parse_dice("5d10<3");
+  assert(d.count == DiceCountAtMost && d.target == 2);
+
+  d = parse_dice("8d10r1>=8");
+  assert(d.reroll == 1 && d.count == DiceCountAtLeast && d.target == 8);
+
+  assert(parse_error("6d6!>=5") == ParserErrorCountModifier);
+  assert(parse_error("6d6kh3>=5") == ParserErrorCountModifier);
+  assert(parse_error("6d6>=") == ParserErrorExpectedInt);
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("10d10>=1 + 10d10<1", &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_evaluate(&p, parsedice_rng_default()) == 10);
+  parsedice_program_destroy(&p);
+}
+
+// Compares counts drawn for d against its exact distribution.
+static void check_count_distribution(ParseDiceRng *rng, Dice d, size_t n_rolls,
+                                     bool logged) {
+  ParseDiceDistribution dist;
+  assert(parsedice_dice_distribution(d, &dist) == ParseDiceOk);
+
+  size_t *observed = calloc(d.amount + 1, sizeof(size_t));
+  ParserConstNum *rolls = logged ? malloc(sizeof(ParserConstNum) * d.amount)
+                                 : NULL;
+
+  for (size_t i = 0; i < n_rolls; i++) {
+    ParserConstNum x = parsedice_dice_roll_rng(rng, d, rolls);
+    assert(x >= 0 && x <= d.amount && x == floor(x));
+    observed[(size_t)x]++;
+  }
+
+  // Chi-squared over the outcomes expected at least five times, with the
+  // rest pooled into one cell.
+  double chi2 = 0, rest_expected = 0, rest_observed = n_rolls;
+  size_t cells = 0;
+
+  for (size_t i = 0; i < dist.length; i++) {
+    double expected = dist.probabilities[i] * n_rolls;
+
+    if (expected < 5)
+      continue;
+
+    double o = observed[(size_t)dist.values[i]];
+    chi2 += (o - expected) * (o - expected) / expected;
+    rest_observed -= o;
+    rest_expected += expected;
+    cells++;
+  }
+
+  rest_expected = n_rolls - rest_expected;
+  if (rest_expected > 0)
+    chi2 += (rest_observed - rest_expected) * (rest_observed - rest_expected) /
+            rest_expected;
+
+  // Far beyond any plausible chance deviation.
+  assert(chi2 < cells + 8 * sqrt(2.0 * cells) + 10);
+
+  free(rolls);
+  free(observed);
+  parsedice_distribution_destroy(&dist);
+}
+
+void test_success_count_roll(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 22);
+
+  Dice cases[] = {
+      // Summed geometric gaps.
+      {.amount = 15, .faces = 10, .count = DiceCountAtLeast, .target = 8},
+      {.amount = 1000, .faces = 1000, .count = DiceCountAtMost, .target = 3},
+      // Transformed rejection, on both sides of one half.
+      {.amount = 20, .faces = 6, .count = DiceCountAtLeast, .target = 4},
+      {.amount = 200, .faces = 10, .count = DiceCountAtLeast, .target = 3},
+      {.amount = 100000, .faces = 10, .reroll = 1, .count = DiceCountAtMost,
+       .target = 4},
+  };
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    check_count_distribution(&rng, cases[i], 200000, false);
+    if (cases[i].amount <= 1000)
+      check_count_distribution(&rng, cases[i], 2000, true);
+  }
+
+  // Huge pools cost one draw and land near the mean.
+  Dice huge = {.amount = 4000000000u, .faces = 10, .count = DiceCountAtLeast,
+               .target = 8};
+
+  for (int i = 0; i < 100; i++) {
+    ParserConstNum x = parsedice_dice_roll_rng(&rng, huge, NULL);
+    assert(fabs(x - 1.2e9) < 6 * sqrt(4e9 * 0.3 * 0.7));
+  }
+
+  // Logged dice are the dice that were counted.
+  ParserConstNum rolls[50];
+  Dice d = {.amount = 50, .faces = 6, .count = DiceCountAtMost, .target = 2};
+  ParserConstNum x = parsedice_dice_roll_rng(&rng, d, rolls);
+  ParserConstNum counted = 0;
+
+  for (size_t i = 0; i < 50; i++)
+    counted += rolls[i] <= 2;
+
+  assert(x == counted);
+}
+
+int main(void) {
+  test_keep_drop_parsing();
+  test_keep_drop_roll();
+  test_keep_drop_distribution();
+  test_keep_drop_optimize();
+  test_explode_reroll_parsing();
+  test_explode_reroll_roll();
+  test_explode_reroll_distribution();
+  test_success_count_parsing();
+  test_success_count_roll();
+}
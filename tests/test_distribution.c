@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <math.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static bool approx_equal(double a, double b) { return fabs(a - b) < 1e-12; }
+
+static ParseDiceStatus distribution_of(const char *input_str,
+                                       ParseDiceDistribution *out) {
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  ParseDiceProgram p;
+  ParseDiceStatus status = parsedice_program_compile(e, &p);
+  assert(status == ParseDiceOk);
+
+  status = parsedice_program_distribution(&p, out);
+
+  parsedice_program_destroy(&p);
+  parsedice_expression_destroy(&e);
+
+  return status;
+}
+
+static double total_probability(ParseDiceDistribution d) {
+  double total = 0;
+  for (size_t i = 0; i < d.length; i++)
+    total += d.probabilities[i];
+
+  return total;
+}
+
+void test_dice_distribution(void) {
+  ParseDiceDistribution d;
+  assert(parsedice_dice_distribution((Dice){.amount = 2, .faces = 6}, &d) ==
+         ParseDiceOk);
+
+  assert(d.length == 11);
+  assert(d.values[0] == 2);
+  assert(d.values[10] == 12);
+  assert(approx_equal(d.probabilities[0], 1.0 / 36));
+  assert(approx_equal(d.probabilities[5], 6.0 / 36));
+  assert(approx_equal(total_probability(d), 1));
+
+  parsedice_distribution_destroy(&d);
+
+  assert(d.values == NULL);
+  assert(d.length == 0);
+}
+
+void test_expression_distribution(void) {
+  {
+    ParseDiceDistribution d;
+    assert(distribution_of("3d6 + 1", &d) == ParseDiceOk);
+
+    assert(d.length == 16);
+    assert(d.values[0] == 4);
+    assert(d.values[15] == 19);
+    // 27 of the 216 outcomes of 3d6 sum to 10.
+    assert(approx_equal(d.probabilities[10 - 3], 27.0 / 216));
+
+    parsedice_distribution_destroy(&d);
+  }
+  {
+    ParseDiceDistribution d;
+    assert(distribution_of("1d4 * 2", &d) == ParseDiceOk);
+
+    assert(d.length == 4);
+    for (size_t i = 0; i < d.length; i++) {
+      assert(d.values[i] == 2 * (i + 1));
+      assert(approx_equal(d.probabilities[i], 0.25));
+    }
+
+    parsedice_distribution_destroy(&d);
+  }
+  {
+    ParseDiceDistribution d;
+    assert(distribution_of("1d6 - 1d6", &d) == ParseDiceOk);
+
+    assert(d.length == 11);
+    assert(d.values[0] == -5);
+    assert(approx_equal(d.probabilities[0], 1.0 / 36));
+    assert(approx_equal(d.probabilities[5], 6.0 / 36));
+
+    parsedice_distribution_destroy(&d);
+  }
+  {
+    ParseDiceDistribution d;
+    assert(distribution_of("1d2 / 2 + 1d2 / 2", &d) == ParseDiceOk);
+
+    assert(d.length == 3);
+    assert(d.values[0] == 1);
+    assert(d.values[1] == 1.5);
+    assert(d.values[2] == 2);
+    assert(approx_equal(d.probabilities[1], 0.5));
+
+    parsedice_distribution_destroy(&d);
+  }
+}
+
+void test_distribution_fft(void) {
+  double a[300], b[200], direct[499], fast[499];
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(a); i++)
+    a[i] = 1.0 / PARSEDICE_ARRAY_SIZE(a);
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(b); i++)
+    b[i] = (i + 1) / (200.0 * 201.0 / 2);
+
+  convolve_direct(a, 300, b, 200, direct);
+  assert(convolve_fft(a, 300, b, 200, fast));
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(direct); i++)
+    assert(fabs(direct[i] - fast[i]) < 1e-14);
+
+  // Large pools go through the FFT path.
+  ParseDiceDistribution d;
+  assert(distribution_of("500d20", &d) == ParseDiceOk);
+
+  double mean = 0;
+  for (size_t i = 0; i < d.length; i++)
+    mean += d.values[i] * d.probabilities[i];
+
+  assert(fabs(total_probability(d) - 1) < 1e-9);
+  assert(fabs(mean - 500 * 10.5) < 1e-6);
+
+  parsedice_distribution_destroy(&d);
+}
+
+void test_distribution_too_large(void) {
+  ParseDiceDistribution d;
+
+  assert(distribution_of("4000000d6", &d) == ParseDiceErrorTooLarge);
+}
+
+int main(void) {
+  test_dice_distribution();
+  test_expression_distribution();
+  test_distribution_fft();
+  test_distribution_too_large();
+}
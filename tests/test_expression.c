@@ -150,9 +150,85 @@ void test_expression_evaluate_postfix() {
   parsedice_expression_destroy(&e);
 }
 
+static void check_postfix(const char *input_str, const char *expected) {
+  ParseDiceExpression e = parsedice_parse_string_postfix(input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  ParseDiceExpression reference = parsedice_parse_string(expected);
+
+  assert(e.length == reference.length);
+
+  for (size_t i = 0; i < e.length; i++) {
+    ParserItem a = e.items[i], b = reference.items[i];
+
+    assert(a.type == b.type);
+
+    if (a.type == ParserConstNumType)
+      assert(a.number == b.number);
+    if (a.type == ParserOperationType)
+      assert(a.operation == b.operation);
+    if (a.type == ParserDiceType)
+      assert(a.dice.amount == b.dice.amount && a.dice.faces == b.dice.faces);
+  }
+
+  parsedice_expression_destroy(&e);
+  parsedice_expression_destroy(&reference);
+}
+
+static void check_postfix_error(const char *input_str, ParserErrorEnum error,
+                                const char *stopped_at) {
+  ParseDiceExpression e = parsedice_parse_string_postfix(input_str);
+
+  assert(e.length > 0);
+
+  ParserItem last = e.items[e.length - 1];
+
+  assert(last.type == ParserErrorType);
+  assert(last.error.type == error);
+  assert(last.error.stopped_at.length == strlen(stopped_at));
+  assert(strncmp(last.error.stopped_at.start, stopped_at,
+                 last.error.stopped_at.length) == 0);
+
+  parsedice_expression_destroy(&e);
+}
+
+void test_expression_parse_postfix(void) {
+  check_postfix("3d6 - 2 * 10", "3d6 2 10 * -");
+  check_postfix("(3d6 - 2) * 10", "3d6 2 - 10 *");
+  check_postfix("1 - 2 - 3", "1 2 - 3 -");
+  check_postfix("((1d4))", "1d4");
+  check_postfix("-2 * 3", "0 2 - 3 *");
+  check_postfix("2 - -1d6", "2 0 1d6 - -");
+  check_postfix("+3", "3");
+
+  check_postfix_error("(1 + 2", ParserErrorUnbalancedParenthesis, "");
+  check_postfix_error("1 + 2) * 3", ParserErrorUnbalancedParenthesis, ") * 3");
+  check_postfix_error("3d8 2", ParserErrorExpectedOperator, "2");
+  check_postfix_error("3d8 +", ParserErrorExpectedOperand, "");
+  check_postfix_error("* 2", ParserErrorExpectedOperand, "* 2");
+  check_postfix_error("1 + 1d-", ParserErrorExpectedInt, "-");
+
+  char deep[PARSEDICE_MAX_NESTING * 2 + 2];
+  memset(deep, '(', sizeof(deep) - 1);
+  deep[sizeof(deep) - 1] = '\0';
+
+  ParseDiceExpression e = parsedice_parse_string_postfix(deep);
+
+  assert(e.items[e.length - 1].type == ParserErrorType);
+  assert(e.items[e.length - 1].error.type == ParserErrorTooDeep);
+
+  parsedice_expression_destroy(&e);
+
+  e = parsedice_parse_string_postfix("  ");
+  assert(e.length == 0);
+  parsedice_expression_destroy(&e);
+}
+
 int main(void) {
   test_expression();
   test_expression_is_balanced();
   test_expression_to_postfix();
   test_expression_evaluate_postfix();
+  test_expression_parse_postfix();
 }
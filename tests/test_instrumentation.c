@@ -0,0 +1,65 @@
+#include <assert.h>
+
+#define PARSEDICE_INSTRUMENTATION
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+void test_counters_parse(void) {
+  parsedice_counters_reset();
+
+  ParseDiceExpression e = parsedice_parse_string("(2d6 + 3) * 1d4");
+
+  ParseDiceCounters c = parsedice_counters_snapshot();
+  assert(c.tokens_lexed == 7);
+  assert(c.allocations == 1);
+  // 2 -> 4 -> 8 items.
+  assert(c.reallocations == 2);
+  assert(c.cycles[ParseDiceStageParse] > 0);
+  assert(c.dice_rolled == 0 && c.rng_calls == 0);
+
+  ParseDiceExpression postfix = parsedice_expression_to_postfix(e);
+
+  c = parsedice_counters_snapshot();
+  assert(c.tokens_lexed == 7);
+  // The postfix expression and the operator stack.
+  assert(c.allocations == 3);
+  assert(c.cycles[ParseDiceStageToPostfix] > 0);
+
+  parsedice_expression_destroy(&postfix);
+  parsedice_expression_destroy(&e);
+
+  parsedice_counters_reset();
+  c = parsedice_counters_snapshot();
+  assert(c.tokens_lexed == 0 && c.allocations == 0);
+  assert(c.cycles[ParseDiceStageParse] == 0);
+}
+
+void test_counters_evaluate(void) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("10d6 + 1d20", &p) == ParseDiceOk);
+
+  parsedice_counters_reset();
+
+  for (int i = 0; i < 100; i++)
+    parsedice_program_evaluate(&p, parsedice_rng_default());
+
+  ParseDiceCounters c = parsedice_counters_snapshot();
+  assert(c.dice_rolled == 1100);
+  // Two 32-bit draws per generator call, plus a few rejections.
+  assert(c.rng_calls >= 600 && c.rng_calls < 700);
+  assert(c.cycles[ParseDiceStageEvaluate] >= c.cycles[ParseDiceStageRoll]);
+  assert(c.cycles[ParseDiceStageRoll] > 0);
+  assert(c.tokens_lexed == 0);
+
+  parsedice_program_destroy(&p);
+
+  parsedice_counters_reset();
+  assert(parsedice_program_compile_string("1d4", &p) == ParseDiceOk);
+  assert(parsedice_counters_snapshot().cycles[ParseDiceStageCompile] > 0);
+  parsedice_program_destroy(&p);
+}
+
+int main(void) {
+  test_counters_parse();
+  test_counters_evaluate();
+}
@@ -0,0 +1,111 @@
+#include <assert.h>
+
+#define PARSEDICE_NUMBER_INT64
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static ParserConstNum evaluate(const char *input_str) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string(input_str, &p) == ParseDiceOk);
+
+  ParserConstNum result = parsedice_program_evaluate(&p, parsedice_rng_default());
+
+  parsedice_program_destroy(&p);
+
+  return result;
+}
+
+void test_integer_division(void) {
+  assert(evaluate("7 / 2") == 3);
+  assert(evaluate("-7 / 2") == -4);
+  assert(evaluate("7 / -2") == -4);
+  assert(evaluate("-7 / -2") == 3);
+  assert(evaluate("-8 / 2") == -4);
+  assert(evaluate("5 / 0") == 0);
+  assert(evaluate("1d6 / 0") == 0);
+
+  // Folded at compile time the same way it runs.
+  ParseDiceProgram p, optimized;
+  assert(parsedice_program_compile_string("(0 - 7) / 2 + 1d4 - 1d4", &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_optimize(&p, &optimized, NULL) == ParseDiceOk);
+
+  assert(optimized.constants_length == 1);
+  assert(optimized.constants[0] == -4);
+
+  parsedice_program_destroy(&p);
+  parsedice_program_destroy(&optimized);
+}
+
+void test_integer_exact(void) {
+  // Past 2^24 a float can't tell 16777217 from 16777216.
+  assert(evaluate("16777216 + 1") == 16777217);
+  assert(evaluate("9007199254740993 - 1") == 9007199254740992);
+  assert(evaluate("9223372036854775807 + 1") == INT64_MIN);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 5);
+
+  Dice d = {.amount = 20000000, .faces = 1};
+  assert(parsedice_dice_roll_rng(&rng, d, NULL) == 20000000);
+
+  d = (Dice){.amount = 3000000, .faces = 100};
+  ParserConstNum sum = parsedice_dice_roll_rng(&rng, d, NULL);
+  assert(sum >= 3000000 && sum <= 300000000);
+
+  ParseDiceExpression e = parsedice_parse_string("12 * 3");
+  ParserItem item = parsedice_expression_evaluate(e);
+  assert(item.type == ParserConstNumType && item.number == 36);
+  parsedice_expression_destroy(&e);
+}
+
+void test_integer_literals(void) {
+  struct {
+    const char *input_str;
+    ParserErrorEnum error;
+  } cases[] = {
+      {"1.5 + 1d6", ParserErrorExpectedInt},
+      {".5", ParserErrorExpectedInt},
+      {"9223372036854775808", ParserErrorNumberTooLarge},
+  };
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    ParseDiceProgram p;
+    ParserError error;
+
+    assert(parsedice_program_compile_slice(
+               (StringSlice){.start = cases[i].input_str,
+                             .length = strlen(cases[i].input_str)},
+               &p, &error) == ParseDiceErrorParse);
+    assert(error.type == cases[i].error);
+  }
+}
+
+void test_integer_distribution(void) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("1d4 / 2", &p) == ParseDiceOk);
+
+  ParseDiceDistribution d;
+  assert(parsedice_program_distribution(&p, &d) == ParseDiceOk);
+
+  // 1, 2, 3, 4 halve to 0, 1, 1, 2.
+  assert(d.length == 3);
+  assert(d.values[0] == 0 && d.probabilities[0] == 0.25);
+  assert(d.values[1] == 1 && d.probabilities[1] == 0.5);
+  assert(d.values[2] == 2 && d.probabilities[2] == 0.25);
+
+  parsedice_distribution_destroy(&d);
+
+  ParseDiceSimulation sim;
+  assert(parsedice_program_simulate(&p, 1, 10000, 1, &sim) == ParseDiceOk);
+  assert(sim.min == 0 && sim.max == 2);
+
+  parsedice_program_destroy(&p);
+}
+
+int main(void) {
+  test_integer_division();
+  test_integer_exact();
+  test_integer_literals();
+  test_integer_distribution();
+}
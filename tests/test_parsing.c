@@ -150,14 +150,76 @@ void test_parethesis_parsing(void) {
   parsedice_expression_destroy(&e);
 }
 
+void test_parse_slice(void) {
+  // Only the first 9 bytes belong to the expression, as if it sat in a
+  // network buffer with no terminator.
+  const char buffer[] = "2d6 + 3d4 garbage";
+
+  ParseDiceExpression e =
+      parsedice_parse_slice((StringSlice){.start = buffer, .length = 9});
+
+  parsedice_expression_print_errors(buffer, e);
+
+  assert(e.length == 3);
+  assert(e.items[0].type == ParserDiceType);
+  assert(e.items[2].type == ParserDiceType);
+  assert(e.items[2].dice.amount == 3);
+  assert(e.items[2].dice.faces == 4);
+
+  parsedice_expression_destroy(&e);
+
+  // A number cut off by the end of the slice must not read past it.
+  e = parsedice_parse_slice((StringSlice){.start = "12345", .length = 2});
+
+  assert(e.length == 1);
+  assert(e.items[0].type == ParserConstNumType);
+  assert(e.items[0].number == 12);
+
+  parsedice_expression_destroy(&e);
+
+  e = parsedice_parse_slice((StringSlice){.start = "4d8", .length = 2});
+
+  assert(e.length == 1);
+  assert(e.items[0].type == ParserErrorType);
+  assert(e.items[0].error.type == ParserErrorExpectedInt);
+  assert(e.items[0].error.stopped_at.length == 0);
+
+  parsedice_expression_destroy(&e);
+}
+
+void test_number_parsing(void) {
+  const char *input_str = ".5 + 0.25 + 12345678901234567890123";
+
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  assert(e.length == 5);
+  assert(e.items[0].number == 0.5f);
+  assert(e.items[2].number == 0.25f);
+  assert(e.items[4].number == 12345678901234567890123.0f);
+
+  parsedice_expression_destroy(&e);
+
+  input_str = "99999999999d6";
+  e = parsedice_parse_string(input_str);
+
+  assert(e.length == 1);
+  assert(e.items[0].type == ParserErrorType);
+  assert(e.items[0].error.type == ParserErrorNumberTooLarge);
+  assert(string_slice_compare(e.items[0].error.stopped_at, input_str));
+
+  parsedice_expression_destroy(&e);
+}
+
 void test_parser_item_stack() {
   ParserItemStack *s = parser_item_stack_create();
 
-  parser_item_stack_push(s,
+  parser_item_stack_push(&s,
                          (ParserItem){.type = ParserDiceType, .dice = {2, 3}});
 
   parser_item_stack_push(
-      s, (ParserItem){.type = ParserConstNumType, .number = 2.0f});
+      &s, (ParserItem){.type = ParserConstNumType, .number = 2.0f});
 
   assert(s->length == 2);
   assert(parser_item_stack_pop(s).type == ParserConstNumType);
@@ -168,6 +230,17 @@ void test_parser_item_stack() {
   assert(parser_item_stack_pop(s).type == ParserNullType);
   assert(s->length == 0);
 
+  // Growing past the default size must keep every item.
+  for (int i = 0; i < 100; i++)
+    parser_item_stack_push(
+        &s, (ParserItem){.type = ParserConstNumType, .number = i});
+
+  assert(s->length == 100);
+  assert(s->capacity >= 100);
+
+  for (int i = 99; i >= 0; i--)
+    assert(parser_item_stack_pop(s).number == i);
+
   parser_item_stack_destroy(s);
 }
 
@@ -178,6 +251,8 @@ int main(void) {
   test_simple_const_num();
   test_complex_parsing();
   test_parethesis_parsing();
+  test_parse_slice();
+  test_number_parsing();
 
   test_parser_item_stack();
 
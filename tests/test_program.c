@@ -0,0 +1,378 @@
+#include <assert.h>
+#include <math.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+void test_program_compile(void) {
+  const char *input_str = "(3d6 - 2) * 10";
+
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  parsedice_expression_print_errors(input_str, e);
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+
+  // In postfix: "3d6 2 - 10 *"
+  assert(p.length == 5);
+  assert(p.constants_length == 2);
+  assert(p.dice_length == 1);
+  assert(p.max_stack_depth == 2);
+
+  assert(p.code[0].opcode == ParseDiceOpRollDice);
+  assert(p.dice[p.code[0].index].amount == 3);
+  assert(p.dice[p.code[0].index].faces == 6);
+
+  assert(p.code[1].opcode == ParseDiceOpPushConst);
+  assert(p.constants[p.code[1].index] == 2);
+
+  assert(p.code[2].opcode == ParseDiceOpOperation);
+  assert(p.code[2].operation == ParserOperationSub);
+
+  assert(p.code[4].opcode == ParseDiceOpOperation);
+  assert(p.code[4].operation == ParserOperationMul);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 1);
+
+  for (int i = 0; i < 100; i++) {
+    ParserConstNum result = parsedice_program_evaluate(&p, &rng);
+
+    assert(result >= 10 && result <= 160);
+  }
+
+  parsedice_program_destroy(&p);
+  parsedice_expression_destroy(&e);
+
+  assert(p.code == NULL);
+  assert(p.length == 0);
+}
+
+void test_program_evaluate_constants(void) {
+  const char *input_str = "1 - 2 * 3 + 4 / 2";
+
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+
+  assert(parsedice_program_evaluate(&p, parsedice_rng_default()) == -3);
+
+  parsedice_program_destroy(&p);
+  parsedice_expression_destroy(&e);
+}
+
+void test_program_compile_errors(void) {
+  struct {
+    const char *input_str;
+    ParseDiceStatus status;
+  } cases[] = {
+      {"((3d8 + 2)) - 2) * 2d4)", ParseDiceErrorUnbalanced},
+      {"3d8 +", ParseDiceErrorMissingOperand},
+      {"3d8 2", ParseDiceErrorMissingOperator},
+      {"1d-", ParseDiceErrorParse},
+  };
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    ParseDiceExpression e = parsedice_parse_string(cases[i].input_str);
+
+    ParseDiceProgram p;
+    assert(parsedice_program_compile(e, &p) == cases[i].status);
+
+    parsedice_expression_destroy(&e);
+  }
+
+  ParseDiceExpression empty = parsedice_expression_create();
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile(empty, &p) == ParseDiceErrorEmpty);
+
+  parsedice_expression_destroy(&empty);
+}
+
+void test_program_evaluate_batch(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 2);
+
+  {
+    const char *input_str = "(20 * 10) / (2 + 2) - 1";
+
+    ParseDiceExpression e = parsedice_parse_string(input_str);
+
+    ParseDiceProgram p;
+    assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+
+    // Not a multiple of the block size, so the last block is partial.
+    ParserConstNum results[PARSEDICE_BATCH_BLOCK_SIZE * 3 + 7];
+    parsedice_program_evaluate_batch(&p, &rng, results,
+                                     PARSEDICE_ARRAY_SIZE(results));
+
+    for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(results); i++)
+      assert(results[i] == 49);
+
+    parsedice_program_destroy(&p);
+    parsedice_expression_destroy(&e);
+  }
+  {
+    const char *input_str = "2d6 * 2 + 1";
+
+    ParseDiceExpression e = parsedice_parse_string(input_str);
+
+    ParserConstNum results[1000];
+    assert(parsedice_expression_evaluate_batch(
+               &rng, e, results, PARSEDICE_ARRAY_SIZE(results)) == ParseDiceOk);
+
+    bool seen[26] = {0};
+    for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(results); i++) {
+      assert(results[i] >= 5 && results[i] <= 25);
+      assert((int)results[i] % 2 == 1);
+      seen[(int)results[i]] = true;
+    }
+
+    // Trials within a block must be independent rolls.
+    assert(seen[13] && seen[15]);
+
+    parsedice_expression_destroy(&e);
+  }
+}
+
+void test_program_evaluate_seeded(void) {
+  ParseDiceExpression e = parsedice_parse_string("4d6 + 2d10 * 3");
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 42);
+  parsedice_rng_seed(&b, 42);
+
+  for (int i = 0; i < 100; i++)
+    assert(parsedice_program_evaluate(&p, &a) ==
+           parsedice_program_evaluate(&p, &b));
+
+  ParserConstNum batch_a[300], batch_b[300];
+  parsedice_program_evaluate_batch(&p, &a, batch_a, 300);
+  parsedice_program_evaluate_batch(&p, &b, batch_b, 300);
+
+  assert(memcmp(batch_a, batch_b, sizeof(batch_a)) == 0);
+
+  parsedice_program_destroy(&p);
+  parsedice_expression_destroy(&e);
+}
+
+void test_program_compile_string(void) {
+  ParseDiceProgram p;
+
+  assert(parsedice_program_compile_string("-(2 * 3) + 10 / -2", &p) ==
+         ParseDiceOk);
+  assert(parsedice_program_evaluate(&p, parsedice_rng_default()) == -11);
+  parsedice_program_destroy(&p);
+
+  const char *input_str = "1d20 + (5 * 2";
+
+  ParserError error;
+  assert(parsedice_program_compile_slice(
+             (StringSlice){.start = input_str, .length = strlen(input_str)},
+             &p, &error) == ParseDiceErrorParse);
+
+  assert(error.type == ParserErrorUnbalancedParenthesis);
+  assert(error.stopped_at.start == input_str + strlen(input_str));
+
+  assert(parsedice_program_compile_string("", &p) == ParseDiceErrorEmpty);
+}
+
+static void check_optimize(const char *input_str, const char *expected,
+                           ParseDiceOptimizeReport expected_report) {
+  ParseDiceProgram p, optimized, reference;
+
+  assert(parsedice_program_compile_string(input_str, &p) == ParseDiceOk);
+  assert(parsedice_program_compile_string(expected, &reference) ==
+         ParseDiceOk);
+
+  ParseDiceOptimizeReport report;
+  assert(parsedice_program_optimize(&p, &optimized, &report) == ParseDiceOk);
+
+  assert(report.constants_folded == expected_report.constants_folded);
+  assert(report.dice_merged == expected_report.dice_merged);
+  assert(report.identities_removed == expected_report.identities_removed);
+  assert(report.constants_hoisted == expected_report.constants_hoisted);
+  assert(report.instructions_before == p.length);
+  assert(report.instructions_after == optimized.length);
+
+  assert(optimized.length == reference.length);
+  assert(optimized.constants_length == reference.constants_length);
+  assert(optimized.dice_length == reference.dice_length);
+
+  for (size_t i = 0; i < optimized.length; i++) {
+    ParseDiceInstruction a = optimized.code[i], b = reference.code[i];
+
+    assert(a.opcode == b.opcode);
+
+    if (a.opcode == ParseDiceOpPushConst)
+      assert(optimized.constants[a.index] == reference.constants[b.index]);
+    if (a.opcode == ParseDiceOpRollDice)
+      assert(optimized.dice[a.index].amount == reference.dice[b.index].amount &&
+             optimized.dice[a.index].faces == reference.dice[b.index].faces);
+    if (a.opcode == ParseDiceOpOperation)
+      assert(a.operation == b.operation);
+  }
+
+  // The optimized program must have exactly the same distribution.
+  ParseDiceDistribution before, after;
+  assert(parsedice_program_distribution(&p, &before) == ParseDiceOk);
+  assert(parsedice_program_distribution(&optimized, &after) == ParseDiceOk);
+
+  assert(before.length == after.length);
+  for (size_t i = 0; i < before.length; i++) {
+    assert(before.values[i] == after.values[i]);
+    assert(fabs(before.probabilities[i] - after.probabilities[i]) < 1e-12);
+  }
+
+  parsedice_distribution_destroy(&before);
+  parsedice_distribution_destroy(&after);
+  parsedice_program_destroy(&p);
+  parsedice_program_destroy(&optimized);
+  parsedice_program_destroy(&reference);
+}
+
+void test_program_optimize(void) {
+  check_optimize("1d6 + 1d6 + 1d6 + 2 * 3", "3d6 + 6",
+                 (ParseDiceOptimizeReport){.constants_folded = 1,
+                                           .dice_merged = 2});
+  check_optimize("(1d8 + 0) * 1", "1d8",
+                 (ParseDiceOptimizeReport){.identities_removed = 2});
+  check_optimize("2 + 1d4 + 3 - 1d4 - 1d4", "1d4 - 2d4 + 5",
+                 (ParseDiceOptimizeReport){.dice_merged = 1,
+                                           .constants_hoisted = 1});
+  check_optimize("2 * 1d6 * 3", "1d6 * 6",
+                 (ParseDiceOptimizeReport){.constants_hoisted = 1});
+  check_optimize("-1d6 - 1d4", "0 - 1d6 - 1d4", (ParseDiceOptimizeReport){0});
+  check_optimize("1d6 + 2 - 2", "1d6",
+                 (ParseDiceOptimizeReport){.constants_hoisted = 1,
+                                           .identities_removed = 1});
+  check_optimize("(1d6 + 1) * (2d4 + 2d4) / 1", "(1d6 + 1) * 4d4",
+                 (ParseDiceOptimizeReport){.dice_merged = 1,
+                                           .identities_removed = 1});
+  check_optimize("(2 + 3) * (4 - 1)", "15",
+                 (ParseDiceOptimizeReport){.constants_folded = 3});
+
+  // A quotient isn't a whole number, so the chain keeps its order and only
+  // the exact identity goes.
+  check_optimize("2d4 / 3 / 2 + 1 - 0 - 3", "2d4 / 3 / 2 + 1 - 3",
+                 (ParseDiceOptimizeReport){.identities_removed = 1});
+
+  // Each removed identity lets the inner chain be rebuilt again inside the
+  // outer one, which used to outgrow the node array.
+  check_optimize("((((((((1d6 + 1d4) * 1 + 1d10) * 1 + 1d11) * 1 + 1d12) * 1 "
+                 "+ 1d13) * 1 + 1d14) * 1 + 1d15) * 1 + 1d16) * 1 + 1d17",
+                 "1d6 + 1d4 + 1d10 + 1d11 + 1d12 + 1d13 + 1d14 + 1d15 + 1d16 "
+                 "+ 1d17",
+                 (ParseDiceOptimizeReport){.identities_removed = 8});
+}
+
+void test_program_simulate(void) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("2d6 + 3", &p) == ParseDiceOk);
+
+  // Not a multiple of the chunk size, so the last chunk is partial.
+  size_t trials = PARSEDICE_SIMULATION_CHUNK_SIZE * 5 + 123;
+
+  ParseDiceSimulation single;
+  assert(parsedice_program_simulate(&p, 7, trials, 1, &single) == ParseDiceOk);
+
+  assert(single.trials == trials);
+  assert(fabs(single.mean - 10) < 0.02);
+  assert(fabs(single.variance - 35.0 / 6) < 0.1);
+  assert(single.min == 5 && single.max == 15);
+
+  unsigned thread_counts[] = {2, 3, 8, 0};
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(thread_counts); i++) {
+    ParseDiceSimulation parallel;
+    assert(parsedice_program_simulate(&p, 7, trials, thread_counts[i],
+                                      &parallel) == ParseDiceOk);
+
+    assert(memcmp(&single, &parallel, sizeof(single)) == 0);
+  }
+
+  ParseDiceSimulation other;
+  assert(parsedice_program_simulate(&p, 8, trials, 0, &other) == ParseDiceOk);
+  assert(other.mean != single.mean);
+
+  assert(parsedice_program_simulate(&p, 7, 0, 0, &other) ==
+         ParseDiceErrorEmpty);
+
+  parsedice_program_destroy(&p);
+}
+
+void test_program_evaluate_logged(void) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("2d6 + 1d20 * 3 + 4", &p) ==
+         ParseDiceOk);
+
+  assert(p.max_rolls == 3);
+
+  ParserConstNum rolls[3];
+  ParseDiceRollSpan spans[2];
+  ParseDiceRollLog log = {
+      .rolls = rolls,
+      .rolls_capacity = PARSEDICE_ARRAY_SIZE(rolls),
+      .spans = spans,
+      .spans_capacity = PARSEDICE_ARRAY_SIZE(spans),
+  };
+
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 9);
+  parsedice_rng_seed(&b, 9);
+
+  for (int i = 0; i < 100; i++) {
+    ParserConstNum result;
+    assert(parsedice_program_evaluate_logged(&p, &a, &log, &result) ==
+           ParseDiceOk);
+
+    // Logging doesn't change what is rolled.
+    assert(result == parsedice_program_evaluate(&p, &b));
+
+    assert(log.rolls_length == 3);
+    assert(log.spans_length == 2);
+
+    assert(spans[0].dice.amount == 2 && spans[0].dice.faces == 6);
+    assert(spans[0].offset == 0 && spans[0].length == 2);
+    assert(spans[0].sum == rolls[0] + rolls[1]);
+    assert(rolls[0] >= 1 && rolls[0] <= 6 && rolls[1] >= 1 && rolls[1] <= 6);
+
+    assert(spans[1].offset == 2 && spans[1].length == 1);
+    assert(spans[1].sum == rolls[2]);
+    assert(rolls[2] >= 1 && rolls[2] <= 20);
+
+    assert(result == spans[0].sum + spans[1].sum * 3 + 4);
+  }
+
+  ParserConstNum result;
+  log.rolls_capacity = 2;
+  assert(parsedice_program_evaluate_logged(&p, &a, &log, &result) ==
+         ParseDiceErrorTooLarge);
+  assert(log.rolls_length == 0 && log.spans_length == 0);
+
+  parsedice_program_destroy(&p);
+
+  assert(parsedice_program_compile_string("(1 + 2) * 3", &p) == ParseDiceOk);
+  assert(p.max_rolls == 0);
+  assert(parsedice_program_evaluate_logged(&p, &a, &(ParseDiceRollLog){0},
+                                           &result) == ParseDiceOk);
+  assert(result == 9);
+  parsedice_program_destroy(&p);
+}
+
+int main(void) {
+  test_program_compile();
+  test_program_evaluate_constants();
+  test_program_compile_errors();
+  test_program_evaluate_batch();
+  test_program_evaluate_seeded();
+  test_program_compile_string();
+  test_program_optimize();
+  test_program_simulate();
+  test_program_evaluate_logged();
+}
@@ -0,0 +1,186 @@
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Lets a test make every realloc fail.
+static bool fail_realloc;
+
+#define PARSEDICE_MALLOC(size) malloc(size)
+#define PARSEDICE_CALLOC(count, size) calloc(count, size)
+#define PARSEDICE_REALLOC(ptr, size) (fail_realloc ? NULL : realloc(ptr, size))
+#define PARSEDICE_FREE(ptr) free(ptr)
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+void test_item_snprint(void) {
+  struct {
+    const char *input_str;
+    const char *expected;
+  } cases[] = {
+      {"4d6!r1kh3", "4d6!r1kh3"},
+      {"10d10dl2", "10d10kh8"},
+      {"15d10>7", "15d10>=8"},
+      {"(2d20kl1 + 3) * 2", "( 2d20kl1 + 3 ) * 2"},
+      {"3500042 - 2", "3500042 - 2"},
+  };
+
+  char text[64];
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(cases); i++) {
+    ParseDiceExpression e = parsedice_parse_string(cases[i].input_str);
+
+    int length = parsedice_expression_snprint(text, sizeof(text), e);
+
+    assert(strcmp(text, cases[i].expected) == 0);
+    assert(length == (int)strlen(cases[i].expected));
+
+    parsedice_expression_destroy(&e);
+  }
+
+  // Like snprintf, text that doesn't fit is cut and still counted.
+  ParseDiceExpression e = parsedice_parse_string("4d6kh3 + 12");
+
+  assert(parsedice_expression_snprint(text, 6, e) == 11);
+  assert(strcmp(text, "4d6kh") == 0);
+  assert(parsedice_expression_snprint(NULL, 0, e) == 11);
+
+  parsedice_expression_destroy(&e);
+}
+
+void test_fprint(void) {
+  char *text;
+  size_t size;
+  FILE *stream = open_memstream(&text, &size);
+
+  const char *input_str = "2d6 + x";
+  ParseDiceExpression e = parsedice_parse_string(input_str);
+
+  parsedice_expression_fprint(stream, e);
+  parsedice_expression_fprint_errors(stream, input_str, e);
+  fclose(stream);
+
+  assert(strncmp(text, "2d6 + ERROR \nERROR (", 20) == 0);
+  assert(strstr(text, "Stopped at: \"x\"") != NULL);
+
+  free(text);
+  parsedice_expression_destroy(&e);
+}
+
+// A scratch stack that can't grow is reported, not ignored.
+void test_stack_out_of_memory(void) {
+  ParseDiceExpression e = parsedice_parse_string("((((((1d6))))))");
+  // 1 2 3 4 5 + + + +, five deep where the stack starts with room for four.
+  ParseDiceExpression deep = parsedice_expression_create();
+
+  for (int i = 1; i <= 5; i++)
+    parsedice_expression_append(
+        &deep, (ParserItem){.type = ParserConstNumType, .number = i});
+  for (int i = 1; i <= 4; i++)
+    parsedice_expression_append(&deep,
+                                (ParserItem){.type = ParserOperationType,
+                                             .operation = ParserOperationAdd});
+
+  fail_realloc = true;
+
+  ParseDiceExpression postfix = parsedice_expression_to_postfix(e);
+  ParserItem last = postfix.items[postfix.length - 1];
+
+  assert(last.type == ParserErrorType);
+  assert(last.error.type == ParserErrorOutOfMemory);
+
+  ParserItem result = parsedice_expression_evaluate_postfix(postfix);
+  assert(result.type == ParserErrorType);
+  assert(result.error.type == ParserErrorOutOfMemory);
+
+  result = parsedice_expression_evaluate_postfix(deep);
+  assert(result.type == ParserErrorType);
+  assert(result.error.type == ParserErrorOutOfMemory);
+
+  ParseDiceProgram p;
+  assert(parsedice_program_compile(e, &p) == ParseDiceErrorOutOfMemory);
+
+  fail_realloc = false;
+
+  assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+  assert(parsedice_expression_evaluate_postfix(deep).number == 15);
+
+  parsedice_program_destroy(&p);
+  parsedice_expression_destroy(&postfix);
+  parsedice_expression_destroy(&deep);
+  parsedice_expression_destroy(&e);
+}
+
+static const char *thread_inputs[] = {
+    "4d6kh3 + 2", "(1d20 + 5) * 2", "15d10>=8", "6d6! - 3", "100d6r1 / 7",
+};
+
+#define THREAD_ROLLS 2000
+
+typedef struct {
+  uint64_t seed;
+  ParserConstNum results[PARSEDICE_ARRAY_SIZE(thread_inputs)][THREAD_ROLLS];
+  char printed[PARSEDICE_ARRAY_SIZE(thread_inputs)][64];
+} ThreadRun;
+
+// Parses, compiles, prints and evaluates every input with only the state
+// in run.
+static void *thread_run(void *arg) {
+  ThreadRun *run = arg;
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, run->seed);
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(thread_inputs); i++) {
+    ParseDiceExpression e = parsedice_parse_string(thread_inputs[i]);
+    parsedice_expression_snprint(run->printed[i], sizeof(run->printed[i]), e);
+
+    ParseDiceProgram p;
+    assert(parsedice_program_compile(e, &p) == ParseDiceOk);
+
+    for (size_t j = 0; j < THREAD_ROLLS; j += 2) {
+      run->results[i][j] = parsedice_program_evaluate(&p, &rng);
+
+      ParserItem result = parsedice_expression_evaluate_rng(&rng, e);
+      assert(result.type == ParserConstNumType);
+      run->results[i][j + 1] = result.number;
+    }
+
+    parsedice_program_destroy(&p);
+    parsedice_expression_destroy(&e);
+  }
+
+  return NULL;
+}
+
+// Threads share nothing, so each gets what it would get alone.
+void test_concurrent_use(void) {
+  static ThreadRun alone[8], together[8];
+  pthread_t threads[8];
+
+  for (size_t i = 0; i < 8; i++) {
+    alone[i].seed = together[i].seed = i * 7919;
+    thread_run(&alone[i]);
+  }
+
+  for (size_t i = 0; i < 8; i++)
+    pthread_create(&threads[i], NULL, thread_run, &together[i]);
+
+  for (size_t i = 0; i < 8; i++)
+    pthread_join(threads[i], NULL);
+
+  for (size_t i = 0; i < 8; i++) {
+    assert(memcmp(alone[i].results, together[i].results,
+                  sizeof(alone[i].results)) == 0);
+    assert(memcmp(alone[i].printed, together[i].printed,
+                  sizeof(alone[i].printed)) == 0);
+  }
+}
+
+int main(void) {
+  test_item_snprint();
+  test_fprint();
+  test_stack_out_of_memory();
+  test_concurrent_use();
+}
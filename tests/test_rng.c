@@ -0,0 +1,315 @@
+#include <assert.h>
+#include <math.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+void test_rng_seed(void) {
+  ParseDiceRng a, b;
+
+  parsedice_rng_seed(&a, 1234);
+  parsedice_rng_seed(&b, 1234);
+
+  for (int i = 0; i < 1000; i++)
+    assert(parsedice_rng_next(&a) == parsedice_rng_next(&b));
+
+  parsedice_rng_seed(&b, 1235);
+  assert(parsedice_rng_next(&a) != parsedice_rng_next(&b));
+}
+
+void test_rng_split(void) {
+  ParseDiceRng parent;
+  parsedice_rng_seed(&parent, 7);
+
+  ParseDiceRng copy = parent;
+  ParseDiceRng jumped = parent;
+  ParseDiceRng child = parsedice_rng_split(&parent);
+
+  // The child continues the original stream, the parent has jumped away.
+  assert(parsedice_rng_next(&child) == parsedice_rng_next(&copy));
+
+  parsedice_rng_jump(&jumped);
+  assert(parsedice_rng_next(&parent) == parsedice_rng_next(&jumped));
+
+  ParseDiceRng long_jumped = child;
+  parsedice_rng_long_jump(&long_jumped);
+  assert(parsedice_rng_next(&long_jumped) != parsedice_rng_next(&child));
+}
+
+void test_rng_bounded(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 99);
+
+  unsigned int counts[6] = {0};
+
+  for (int i = 0; i < 60000; i++) {
+    uint32_t r = parsedice_rng_bounded(&rng, 6);
+
+    assert(r < 6);
+    counts[r]++;
+  }
+
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(counts); i++)
+    assert(counts[i] > 9000 && counts[i] < 11000);
+}
+
+void test_dice_roll_rng(void) {
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 5);
+  parsedice_rng_seed(&b, 5);
+
+  Dice d = {.amount = 20, .faces = 8};
+
+  ParserConstNum results[20];
+  ParserConstNum total = parsedice_dice_roll_rng(&a, d, results);
+
+  ParserConstNum sum = 0;
+  for (size_t i = 0; i < d.amount; i++) {
+    assert(results[i] >= 1 && results[i] <= 8);
+    sum += results[i];
+  }
+
+  assert(total == sum);
+  assert(parsedice_dice_roll_rng(&b, d, NULL) == total);
+
+  assert(parsedice_dice_roll_rng(&a, (Dice){.amount = 3, .faces = 0}, NULL) ==
+         0);
+}
+
+static void check_kernel(RollKernel kernel, const uint32_t *words,
+                         size_t n_words, uint32_t faces, size_t wanted) {
+  uint32_t threshold = bounded_threshold(faces);
+
+  uint64_t expected_sum = 0, sum = 0;
+  size_t expected_consumed, consumed;
+
+  size_t expected = roll_words_scalar(words, n_words, faces, threshold, wanted,
+                                      &expected_sum, &expected_consumed);
+  size_t rolled =
+      kernel(words, n_words, faces, threshold, wanted, &sum, &consumed);
+
+  assert(rolled == expected);
+  assert(sum == expected_sum);
+  assert(consumed == expected_consumed);
+}
+
+void test_dice_roll_kernels(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 11);
+
+  uint32_t words[PARSEDICE_ROLL_BUFFER_WORDS];
+  rng_fill_words(&rng, words, PARSEDICE_ROLL_BUFFER_WORDS);
+
+  // Large face counts reject often, which exercises the scalar fallback
+  // inside the vector loops.
+  uint32_t faces[] = {1, 2, 6, 10, 20, 100, 3000000000u};
+  size_t wanted[] = {0, 1, 7, 100, 255, 1000};
+
+  for (size_t f = 0; f < PARSEDICE_ARRAY_SIZE(faces); f++) {
+    for (size_t w = 0; w < PARSEDICE_ARRAY_SIZE(wanted); w++) {
+      check_kernel(roll_kernel_select(), words, PARSEDICE_ROLL_BUFFER_WORDS,
+                   faces[f], wanted[w]);
+#ifdef PARSEDICE_X86_SIMD
+      check_kernel(roll_words_sse2, words, PARSEDICE_ROLL_BUFFER_WORDS,
+                   faces[f], wanted[w]);
+      if (__builtin_cpu_supports("avx2"))
+        check_kernel(roll_words_avx2, words, PARSEDICE_ROLL_BUFFER_WORDS,
+                     faces[f], wanted[w]);
+#endif
+    }
+  }
+}
+
+void test_dice_roll_large_pool(void) {
+  ParseDiceRng a, b;
+  parsedice_rng_seed(&a, 8);
+  parsedice_rng_seed(&b, 8);
+
+  Dice d = {.amount = 1000, .faces = 6};
+
+  // Recording the individual dice takes the scalar path, the sum alone
+  // takes the vector kernel. Both must agree.
+  ParserConstNum results[1000];
+  ParserConstNum with_results = parsedice_dice_roll_rng(&a, d, results);
+  ParserConstNum without_results = parsedice_dice_roll_rng(&b, d, NULL);
+
+  assert(with_results == without_results);
+
+  unsigned int counts[7] = {0};
+  for (size_t i = 0; i < d.amount; i++)
+    counts[(int)results[i]]++;
+
+  assert(counts[0] == 0);
+  for (size_t i = 1; i < PARSEDICE_ARRAY_SIZE(counts); i++)
+    assert(counts[i] > 100 && counts[i] < 240);
+
+  assert(with_results > 3000 && with_results < 4000);
+}
+
+static void sample_moments(ParseDiceAliasCache *c, ParseDiceRng *rng, Dice d,
+                           size_t n, double *mean, double *variance) {
+  double sum = 0, sum_squares = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    double x = parsedice_dice_sample(c, rng, d);
+
+    assert(x >= d.amount && x <= (double)d.amount * d.faces);
+    sum += x;
+    sum_squares += x * x;
+  }
+
+  *mean = sum / n;
+  *variance = sum_squares / n - *mean * *mean;
+}
+
+void test_dice_sample_alias(void) {
+  ParseDiceAliasCache c;
+  parsedice_alias_cache_init(&c);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 3);
+
+  Dice d = {.amount = 500, .faces = 20};
+
+  double mean, variance;
+  sample_moments(&c, &rng, d, 100000, &mean, &variance);
+
+  // Expected mean 5250, variance 500 * 399 / 12 = 16625.
+  assert(fabs(mean - 5250) < 3);
+  assert(fabs(variance - 16625) < 500);
+
+  assert(c.length == 1);
+  // Sums rarer than the FFT's rounding noise are left out of the table.
+  assert(c.tables[0].length > 1000 && c.tables[0].length <= 500 * 19 + 1);
+
+  double total = 0;
+  for (size_t i = 0; i < c.tables[0].length; i++) {
+    assert(c.tables[0].probabilities[i] >= 0 &&
+           c.tables[0].probabilities[i] <= 1);
+    assert(c.tables[0].alias[i] < c.tables[0].length);
+    total += c.tables[0].probabilities[i];
+  }
+  assert(total > 0);
+
+  // Small pools are rolled directly and never cached.
+  parsedice_dice_sample(&c, &rng, (Dice){.amount = 2, .faces = 6});
+  assert(c.length == 1);
+
+  for (DiceInt amount = 10; amount < 10 + 2 * PARSEDICE_ALIAS_CACHE_SIZE;
+       amount++)
+    parsedice_dice_sample(&c, &rng, (Dice){.amount = amount, .faces = 6});
+
+  assert(c.length == PARSEDICE_ALIAS_CACHE_SIZE);
+
+  parsedice_alias_cache_destroy(&c);
+}
+
+void test_dice_sample_normal(void) {
+  ParseDiceAliasCache c;
+  parsedice_alias_cache_init(&c);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 4);
+
+  Dice d = {.amount = 100000, .faces = 6};
+
+  double mean, variance;
+  sample_moments(&c, &rng, d, 20000, &mean, &variance);
+
+  // Expected mean 350000, variance 100000 * 35 / 12 = 291666.
+  assert(fabs(mean - 350000) < 30);
+  assert(fabs(variance - 291666) < 20000);
+
+  assert(c.length == 0);
+
+  // A few dice with many faces have too many sums for a table but tails far
+  // from normal, so they are rolled exactly.
+  ParseDiceRng a = rng, b = rng;
+  Dice few = {.amount = 8, .faces = 100000};
+
+  for (int i = 0; i < 100; i++)
+    assert(parsedice_dice_sample(&c, &a, few) ==
+           parsedice_dice_roll_rng(&b, few, NULL));
+
+  assert(c.length == 0);
+
+  parsedice_alias_cache_destroy(&c);
+}
+
+void test_dice_roll_counts(void) {
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 23);
+
+  uint64_t counts[6];
+  Dice d = {.amount = 1000000, .faces = 6};
+
+  // Every face, including the one that takes the remainder, is binomial
+  // with mean 1000000 / 6 and variance 1000000 * 5 / 36.
+  double sums[6] = {0}, squares[6] = {0};
+
+  for (int trial = 0; trial < 2000; trial++) {
+    assert(parsedice_dice_roll_counts(&rng, d, counts, 6) == ParseDiceOk);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < 6; i++) {
+      total += counts[i];
+      sums[i] += counts[i];
+      squares[i] += (double)counts[i] * counts[i];
+    }
+
+    assert(total == d.amount);
+  }
+
+  for (size_t i = 0; i < 6; i++) {
+    double mean = sums[i] / 2000;
+    double variance = squares[i] / 2000 - mean * mean;
+
+    assert(fabs(mean - 1000000.0 / 6) < 50);
+    assert(fabs(variance / (1000000.0 * 5 / 36) - 1) < 0.15);
+  }
+
+  // Rerolled faces never come up.
+  d = (Dice){.amount = 1000, .faces = 6, .reroll = 2};
+  assert(parsedice_dice_roll_counts(&rng, d, counts, 6) == ParseDiceOk);
+  assert(counts[0] == 0 && counts[1] == 0);
+  assert(counts[2] + counts[3] + counts[4] + counts[5] == 1000);
+
+  // Only kept dice are counted, 4d6kh3 averaging 15869 / 1296.
+  d = (Dice){.amount = 4, .faces = 6, .keep = DiceKeepHighest,
+             .keep_count = 3};
+  double kept = 0;
+
+  for (int trial = 0; trial < 100000; trial++) {
+    assert(parsedice_dice_roll_counts(&rng, d, counts, 6) == ParseDiceOk);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < 6; i++) {
+      total += counts[i];
+      kept += (double)counts[i] * (i + 1);
+    }
+
+    assert(total == 3);
+  }
+
+  assert(fabs(kept / 100000 - 15869.0 / 1296) < 0.05);
+
+  d = (Dice){.amount = 4, .faces = 6};
+  assert(parsedice_dice_roll_counts(&rng, d, counts, 5) ==
+         ParseDiceErrorTooLarge);
+
+  d.explode = true;
+  assert(parsedice_dice_roll_counts(&rng, d, counts, 6) ==
+         ParseDiceErrorUnsupported);
+}
+
+int main(void) {
+  test_rng_seed();
+  test_rng_split();
+  test_rng_bounded();
+  test_dice_roll_rng();
+  test_dice_roll_kernels();
+  test_dice_roll_large_pool();
+  test_dice_sample_alias();
+  test_dice_sample_normal();
+  test_dice_roll_counts();
+}
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <math.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+static bool close_to(double x, double expected, double relative) {
+  return fabs(x - expected) <= relative * fabs(expected);
+}
+
+void test_stats_add(void) {
+  ParseDiceStats *s = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(s, 0, 1000);
+
+  for (int i = 1; i <= 1000; i++)
+    parsedice_stats_add(s, i);
+
+  assert(s->moments.n == 1000);
+  assert(close_to(s->moments.mean, 500.5, 1e-12));
+  assert(close_to(parsedice_stats_variance(s), 1000.0 * 1001 / 12, 1e-12));
+  assert(s->moments.min == 1 && s->moments.max == 1000);
+
+  uint64_t bucketed = 0;
+  for (size_t i = 0; i < PARSEDICE_STATS_HISTOGRAM_BUCKETS; i++)
+    bucketed += s->histogram[i];
+
+  // 1000 itself is past the end of the range.
+  assert(bucketed == 999);
+  assert(s->underflow == 0 && s->overflow == 1);
+
+  double qs[] = {0.1, 0.25, 0.5, 0.9, 0.99};
+  for (size_t i = 0; i < PARSEDICE_ARRAY_SIZE(qs); i++) {
+    double exact = 1 + floor(qs[i] * 999);
+    assert(close_to(parsedice_stats_quantile(s, qs[i]), exact,
+                    PARSEDICE_STATS_SKETCH_ALPHA));
+  }
+
+  assert(parsedice_stats_quantile(s, 0) == 1);
+  assert(parsedice_stats_quantile(s, 1) == 1000);
+
+  free(s);
+}
+
+void test_stats_negative(void) {
+  ParseDiceStats *s = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(s, -10, 10);
+
+  ParserConstNum xs[] = {-8, -4, -2, 0, 0, 3, 5, 9, 0.5};
+  parsedice_stats_add_batch(s, xs, PARSEDICE_ARRAY_SIZE(xs));
+
+  assert(s->sketch_zero == 2);
+  assert(close_to(parsedice_stats_quantile(s, 0.125), -4, 0.01));
+  assert(parsedice_stats_quantile(s, 0.375) == 0);
+  assert(close_to(parsedice_stats_quantile(s, 0.625), 0.5, 0.01));
+  assert(close_to(parsedice_stats_quantile(s, 0.875), 5, 0.01));
+
+  ParseDiceStats *empty = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(empty, 0, 1);
+  assert(isnan(parsedice_stats_quantile(empty, 0.5)));
+
+  free(s);
+  free(empty);
+}
+
+// A value just below the top of the range whose bucket index rounds up to
+// one past the last.
+void test_stats_top_bucket(void) {
+  ParseDiceStats *s = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(s, -0x1.1ba1f3363743ep-10, 0x1.20fdb00000001p-8);
+
+  parsedice_stats_add(s, 0x1.20fdbp-8f);
+
+  assert(s->histogram[PARSEDICE_STATS_HISTOGRAM_BUCKETS - 1] == 1);
+  assert(s->underflow == 0 && s->overflow == 0);
+
+  free(s);
+}
+
+void test_stats_merge(void) {
+  ParseDiceStats *all = malloc(sizeof(ParseDiceStats));
+  ParseDiceStats *a = malloc(sizeof(ParseDiceStats));
+  ParseDiceStats *b = malloc(sizeof(ParseDiceStats));
+
+  parsedice_stats_init(all, 3, 18);
+  parsedice_stats_init(a, 3, 18);
+  parsedice_stats_init(b, 3, 18);
+
+  ParseDiceRng rng;
+  parsedice_rng_seed(&rng, 3);
+
+  Dice d = {.amount = 3, .faces = 6};
+
+  for (int i = 0; i < 10000; i++) {
+    ParserConstNum x = parsedice_dice_roll_rng(&rng, d, NULL);
+
+    parsedice_stats_add(all, x);
+    parsedice_stats_add(i % 3 == 0 ? a : b, x);
+  }
+
+  assert(parsedice_stats_merge(a, b) == ParseDiceOk);
+
+  assert(a->moments.n == all->moments.n);
+  assert(close_to(a->moments.mean, all->moments.mean, 1e-12));
+  assert(close_to(a->moments.m2, all->moments.m2, 1e-12));
+  assert(a->moments.min == all->moments.min);
+  assert(a->moments.max == all->moments.max);
+
+  assert(memcmp(a->histogram, all->histogram, sizeof(a->histogram)) == 0);
+  assert(memcmp(a->sketch_positive, all->sketch_positive,
+                sizeof(a->sketch_positive)) == 0);
+
+  parsedice_stats_init(b, 0, 18);
+  assert(parsedice_stats_merge(a, b) == ParseDiceErrorMismatch);
+
+  free(all);
+  free(a);
+  free(b);
+}
+
+void test_stats_simulate(void) {
+  ParseDiceProgram p;
+  assert(parsedice_program_compile_string("4d6 - 1d8", &p) == ParseDiceOk);
+
+  size_t trials = PARSEDICE_SIMULATION_CHUNK_SIZE * 3 + 5;
+
+  ParseDiceStats *single = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(single, -4, 24);
+
+  assert(parsedice_program_simulate_stats(&p, 11, trials, 1, single) ==
+         ParseDiceOk);
+
+  assert(single->moments.n == trials);
+  assert(fabs(single->moments.mean - 9.5) < 0.02);
+  assert(single->moments.min >= -4 && single->moments.max <= 23);
+  assert(single->underflow == 0 && single->overflow == 0);
+  assert(close_to(parsedice_stats_quantile(single, 0.5), 10, 0.01));
+
+  ParseDiceSimulation sim;
+  assert(parsedice_program_simulate(&p, 11, trials, 1, &sim) == ParseDiceOk);
+  assert(sim.mean == single->moments.mean);
+
+  ParseDiceStats *parallel = malloc(sizeof(ParseDiceStats));
+  parsedice_stats_init(parallel, -4, 24);
+
+  assert(parsedice_program_simulate_stats(&p, 11, trials, 3, parallel) ==
+         ParseDiceOk);
+
+  assert(memcmp(single, parallel, sizeof(ParseDiceStats)) == 0);
+
+  free(single);
+  free(parallel);
+  parsedice_program_destroy(&p);
+}
+
+int main(void) {
+  test_stats_add();
+  test_stats_negative();
+  test_stats_top_bucket();
+  test_stats_merge();
+  test_stats_simulate();
+}
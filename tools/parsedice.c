@@ -0,0 +1,246 @@
+// Rolls every expression read from the input, one per line, and writes
+// each line's results space-separated on a line of their own.
+//
+//   parsedice [-n trials] [-s seed] [file ...]
+//
+// Reads stdin when no file (or "-") is given. Lines that don't compile are
+// reported on stderr and leave an empty output line, so output lines stay
+// aligned with input lines.
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PARSEDICE_IMPLEMENTATION
+#include "parsedice.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+// Longest formatted result, with room for the separator.
+#define OUTPUT_MAX_NUMBER 64
+#define TRIALS_BLOCK_SIZE 4096
+
+typedef struct {
+  char data[OUTPUT_BUFFER_SIZE];
+  size_t length;
+  bool failed;
+} Output;
+
+static void output_flush(Output *out) {
+  if (out->length > 0 &&
+      fwrite(out->data, 1, out->length, stdout) != out->length)
+    out->failed = true;
+
+  out->length = 0;
+}
+
+static void output_reserve(Output *out, size_t n) {
+  if (out->length + n > OUTPUT_BUFFER_SIZE)
+    output_flush(out);
+}
+
+static void output_char(Output *out, char c) {
+  output_reserve(out, 1);
+  out->data[out->length++] = c;
+}
+
+// Results are almost always whole numbers, which skip printf.
+static void output_number(Output *out, ParserConstNum x) {
+  output_reserve(out, OUTPUT_MAX_NUMBER);
+
+  char *at = out->data + out->length;
+
+#ifndef PARSEDICE_NUMBER_INT64
+  // Range first: converting inf, NaN or anything past 2^63 is undefined.
+  if (!isfinite(x) || x > 1e15 || x < -1e15 || x != (int64_t)x) {
+    out->length += snprintf(at, OUTPUT_MAX_NUMBER, "%g", (double)x);
+    return;
+  }
+#endif
+
+  int64_t v = (int64_t)x;
+  uint64_t u = v < 0 ? -(uint64_t)v : (uint64_t)v;
+
+  char digits[24];
+  size_t n = 0;
+
+  do {
+    digits[n++] = '0' + u % 10;
+    u /= 10;
+  } while (u > 0);
+
+  if (v < 0)
+    *at++ = '-';
+
+  while (n > 0)
+    *at++ = digits[--n];
+
+  out->length = at - out->data;
+}
+
+typedef struct {
+  size_t trials;
+  ParseDiceRng rng;
+  bool had_errors;
+} Options;
+
+static void roll_line(Options *o, Output *out, const char *name,
+                      size_t line_number, StringSlice line) {
+  static ParserConstNum results[TRIALS_BLOCK_SIZE];
+
+  ParseDiceProgram p;
+  ParserError error;
+  ParseDiceStatus status = parsedice_program_compile_slice(line, &p, &error);
+
+  if (status == ParseDiceErrorEmpty) {
+    output_char(out, '\n');
+    return;
+  }
+
+  if (status != ParseDiceOk) {
+    // Keep stdout and stderr in order when both go to a terminal.
+    output_flush(out);
+
+    if (status == ParseDiceErrorParse)
+      fprintf(stderr, "%s:%zu:%zu: %s\n", name, line_number,
+              (size_t)(error.stopped_at.start - line.start) + 1,
+              parsedice_parse_error_to_string(error));
+    else
+      fprintf(stderr, "%s:%zu: %s\n", name, line_number,
+              parsedice_status_to_string(status));
+
+    o->had_errors = true;
+    output_char(out, '\n');
+    return;
+  }
+
+  for (size_t done = 0; done < o->trials;) {
+    size_t n = o->trials - done < TRIALS_BLOCK_SIZE ? o->trials - done
+                                                    : TRIALS_BLOCK_SIZE;
+
+    parsedice_program_evaluate_batch(&p, &o->rng, results, n);
+
+    for (size_t i = 0; i < n; i++) {
+      if (done + i > 0)
+        output_char(out, ' ');
+
+      output_number(out, results[i]);
+    }
+
+    done += n;
+  }
+
+  output_char(out, '\n');
+
+  parsedice_program_destroy(&p);
+}
+
+static bool roll_file(Options *o, Output *out, const char *name, FILE *f) {
+  char *line = NULL;
+  size_t capacity = 0;
+  size_t line_number = 0;
+  ssize_t length;
+
+  while ((length = getline(&line, &capacity, f)) >= 0) {
+    line_number++;
+
+    while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r'))
+      length--;
+
+    roll_line(o, out, name, line_number,
+              (StringSlice){.start = line, .length = length});
+  }
+
+  free(line);
+
+  return !ferror(f);
+}
+
+static void usage(FILE *f) {
+  fprintf(f, "usage: parsedice [-n trials] [-s seed] [file ...]\n"
+             "\n"
+             "  -n trials  rolls per expression (default 1)\n"
+             "  -s seed    seed the generator for reproducible output\n"
+             "  -h         show this help\n");
+}
+
+static bool parse_u64(const char *s, uint64_t *out) {
+  char *end;
+
+  errno = 0;
+  unsigned long long v = strtoull(s, &end, 0);
+
+  if (errno != 0 || end == s || *end != '\0' || *s == '-')
+    return false;
+
+  *out = v;
+
+  return true;
+}
+
+int main(int argc, char **argv) {
+  static Output out;
+
+  Options o = {.trials = 1, .rng = *parsedice_rng_default()};
+
+  int opt;
+  uint64_t value;
+
+  while ((opt = getopt(argc, argv, "n:s:h")) != -1) {
+    switch (opt) {
+    case 'n':
+      if (!parse_u64(optarg, &value)) {
+        fprintf(stderr, "parsedice: invalid trial count '%s'\n", optarg);
+        return 2;
+      }
+
+      o.trials = value;
+      break;
+    case 's':
+      if (!parse_u64(optarg, &value)) {
+        fprintf(stderr, "parsedice: invalid seed '%s'\n", optarg);
+        return 2;
+      }
+
+      parsedice_rng_seed(&o.rng, value);
+      break;
+    case 'h':
+      usage(stdout);
+      return 0;
+    default:
+      usage(stderr);
+      return 2;
+    }
+  }
+
+  bool ok = true;
+
+  if (optind == argc) {
+    ok = roll_file(&o, &out, "<stdin>", stdin);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    if (strcmp(argv[i], "-") == 0) {
+      ok &= roll_file(&o, &out, "<stdin>", stdin);
+      continue;
+    }
+
+    FILE *f = fopen(argv[i], "r");
+
+    if (f == NULL) {
+      output_flush(&out);
+      fprintf(stderr, "parsedice: %s: %s\n", argv[i], strerror(errno));
+      ok = false;
+      continue;
+    }
+
+    ok &= roll_file(&o, &out, argv[i], f);
+    fclose(f);
+  }
+
+  output_flush(&out);
+
+  if (fflush(stdout) != 0 || out.failed)
+    ok = false;
+
+  return !ok ? 2 : o.had_errors ? 1 : 0;
+}